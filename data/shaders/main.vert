@@ -4,7 +4,9 @@ layout (location = 0) in vec3 iPosition;
 layout (location = 1) in vec3 iNormal;
 layout (location = 2) in vec2 iTexCoord;
 
-uniform mat4 uTransform;
+layout (std140, binding = 0) uniform Frame {
+	mat4 uTransform;
+};
 
 out vec3 sPosition;
 out vec3 sNormal;
@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include <cstdio>
 #include <cstddef>
 #include <cstdint>
@@ -20,6 +21,9 @@ namespace av {
 
 		~Owned() { if (Ptr_) delete Ptr_; }
 
+		/// Gives up ownership without deleting.
+		T *Release() { T *ptr = Ptr_; Ptr_ = nullptr; return ptr; }
+
 		T *Get() { return Ptr_; }
 		const T *Get() const { return Ptr_; }
 
@@ -36,6 +40,8 @@ namespace av {
 	template<typename T>
 	class Ref {
 	public:
+		Ref() : Ptr_(nullptr) {}
+
 		template<typename U>
 		Ref(U *raw) : Ptr_(raw) {}
 
@@ -142,11 +148,173 @@ namespace av {
 			this->Count_ = newCount;
 		}
 	};
+
+	/// Like OwningSpan, but grows geometrically and keeps its allocation on Clear.
+	template<typename T>
+	class GrowingSpan : public Span<T> {
+	public:
+		GrowingSpan() : Span<T>(nullptr, 0), Capacity_(0) {}
+		GrowingSpan(const GrowingSpan &) = delete;
+		GrowingSpan &operator=(const GrowingSpan &) = delete;
+
+		~GrowingSpan() { delete[] this->Data_; }
+
+		size_t GetCapacity() const { return Capacity_; }
+
+		void Reserve(size_t capacity) {
+			if (capacity <= Capacity_) return;
+			T *newData = new T[capacity];
+			if (this->Count_) CopyItems(newData, this->Data_, this->Count_);
+			delete[] this->Data_;
+			this->Data_ = newData;
+			Capacity_ = capacity;
+		}
+
+		void Resize(size_t newCount) {
+			if (newCount > Capacity_) {
+				size_t grown = Capacity_ < 16 ? 16 : Capacity_ * 2;
+				Reserve(newCount > grown ? newCount : grown);
+			}
+			this->Count_ = newCount;
+		}
+
+		/// Appends `count` uninitialized items and returns a pointer to the first.
+		T *Extend(size_t count) {
+			size_t offset = this->Count_;
+			Resize(offset + count);
+			return this->Data_ + offset;
+		}
+
+		T &Push(const T &item) { return *Extend(1) = item; }
+
+		void Clear() { this->Count_ = 0; }
+
+		void Swap(GrowingSpan &other) {
+			T *data = this->Data_; this->Data_ = other.Data_; other.Data_ = data;
+			size_t count = this->Count_; this->Count_ = other.Count_; other.Count_ = count;
+			size_t capacity = Capacity_; Capacity_ = other.Capacity_; other.Capacity_ = capacity;
+		}
+
+	private:
+		size_t Capacity_;
+	};
+
+	/// 32-bit reference to an item of a SlotMap: the index of its slot and the
+	/// generation the slot was at when the item went in. Slots move to the next
+	/// generation when their item is removed, so old handles stop resolving
+	/// instead of dangling. A slot that has used up its generations is retired
+	/// rather than wrapped around, so no handle ever resolves to a later item
+	/// of its slot. The zero handle never resolves.
+	template<typename T>
+	class Handle {
+	public:
+		static constexpr uint32_t IndexBits = 20;
+		static constexpr uint32_t MaxIndex = (1u << IndexBits) - 1;
+		static constexpr uint32_t MaxGeneration = (1u << (32 - IndexBits)) - 1;
+
+		Handle() : Value_(0) {}
+		Handle(uint32_t index, uint32_t generation) : Value_(generation << IndexBits | index) {}
+
+		uint32_t GetIndex() const { return Value_ & MaxIndex; }
+		uint32_t GetGeneration() const { return Value_ >> IndexBits; }
+		uint32_t GetValue() const { return Value_; }
+		bool IsValid() const { return Value_ != 0; }
+
+		bool operator==(const Handle &other) const { return Value_ == other.Value_; }
+		bool operator!=(const Handle &other) const { return Value_ != other.Value_; }
+
+	private:
+		uint32_t Value_;
+	};
+
+	/// Items kept packed in one array, addressed through Handle<Tag>s that stay
+	/// put while the items move. Removal swaps the last item into the hole, so
+	/// items must be plain data.
+	template<typename Tag, typename T>
+	class SlotMap {
+		static_assert(__is_trivially_copyable(T), "SlotMap items are moved with memcpy");
+
+	public:
+		/// Returns the zero handle if every slot is taken.
+		Handle<Tag> Insert(const T &item) {
+			uint32_t index;
+			if (FreeSlot_ != NoSlot_) {
+				index = FreeSlot_;
+				FreeSlot_ = Slots_[index].Dense;
+			} else {
+				if (Slots_.GetCount() > Handle<Tag>::MaxIndex) return {};
+				index = Slots_.GetCount();
+				Slots_.Push({ 0, 1 });
+			}
+			Slots_[index].Dense = Items_.GetCount();
+			Items_.Push(item);
+			Owners_.Push(index);
+			return { index, Slots_[index].Generation };
+		}
+
+		/// Null if the handle's item has been removed.
+		T *Get(Handle<Tag> handle) {
+			uint32_t index = handle.GetIndex();
+			if (index >= Slots_.GetCount() || Slots_[index].Generation != handle.GetGeneration()) return nullptr;
+			return &Items_[Slots_[index].Dense];
+		}
+
+		const T *Get(Handle<Tag> handle) const { return const_cast<SlotMap*>(this)->Get(handle); }
+
+		bool Remove(Handle<Tag> handle) {
+			if (!Get(handle)) return false;
+			auto &slot = Slots_[handle.GetIndex()];
+			uint32_t last = Items_.GetCount() - 1;
+			Items_[slot.Dense] = Items_[last];
+			Owners_[slot.Dense] = Owners_[last];
+			Slots_[Owners_[slot.Dense]].Dense = slot.Dense;
+			Items_.Resize(last);
+			Owners_.Resize(last);
+
+			// Retiring costs a slot every MaxGeneration removals, which leaves
+			// billions of them before Insert runs out.
+			if (slot.Generation == Handle<Tag>::MaxGeneration) {
+				slot.Generation = RetiredGeneration_;
+				return true;
+			}
+			slot.Generation += 1;
+			slot.Dense = FreeSlot_;
+			FreeSlot_ = handle.GetIndex();
+			return true;
+		}
+
+		size_t GetCount() const { return Items_.GetCount(); }
+		/// The items in no particular order; GetHandle maps positions back.
+		Span<T> GetItems() { return Items_; }
+		Handle<Tag> GetHandle(size_t position) const {
+			uint32_t index = Owners_[position];
+			return { index, Slots_[index].Generation };
+		}
+
+	private:
+		static constexpr uint32_t NoSlot_ = 0xFFFFFFFF;
+		/// Past any generation a handle can hold, so nothing matches it.
+		static constexpr uint32_t RetiredGeneration_ = 0xFFFFFFFF;
+
+		struct Slot_ {
+			/// Position in Items_, or the next free slot while free.
+			uint32_t Dense;
+			uint32_t Generation;
+		};
+
+		GrowingSpan<T> Items_;
+		/// Slot of each item in Items_.
+		GrowingSpan<uint32_t> Owners_;
+		GrowingSpan<Slot_> Slots_;
+		uint32_t FreeSlot_ = NoSlot_;
+	};
 }
 
 namespace av::fs {
 	size_t GetFileSize(const char *filename);
 	size_t GetFileSize(FILE *fptr);
+	/// Creates the directory if it doesn't exist yet. Parents must exist.
+	bool CreateDirectory(const char *path);
 }
 
 namespace av::graphics {
@@ -154,7 +322,12 @@ namespace av::graphics {
 		Float32 = 0x00, Float64 = 0x01,
 		Int8 = 0x02, Int16 = 0x03, Int32 = 0x04, Int64 = 0x05,
 		UInt8 = 0x06, UInt16 = 0x07, UInt32 = 0x08, UInt64 = 0x09,
-		Uniform_Sampler2D = 0x0A, Uniform_SamplerCube = 0x0B
+		Uniform_Sampler2D = 0x0A, Uniform_SamplerCube = 0x0B,
+		/// IEEE half float.
+		Half16 = 0x0C,
+		/// All four components in one 32-bit word, x in the low 10 bits and w
+		/// in the top 2. Only valid for attributes with Dimension 4.
+		Int_2_10_10_10_Rev = 0x0D, UInt_2_10_10_10_Rev = 0x0E
 	};
 
 	constexpr const char *DataTypeToString(DataType type) {
@@ -171,6 +344,9 @@ namespace av::graphics {
 			case DataType::UInt64: return "UInt64";
 			case DataType::Uniform_Sampler2D: return "Sampler2D";
 			case DataType::Uniform_SamplerCube: return "SamplerCube";
+			case DataType::Half16: return "Half16";
+			case DataType::Int_2_10_10_10_Rev: return "Int_2_10_10_10_Rev";
+			case DataType::UInt_2_10_10_10_Rev: return "UInt_2_10_10_10_Rev";
 			default: return "Unknown";
 		}
 	}
@@ -178,6 +354,13 @@ namespace av::graphics {
 	struct VertexAttribute {
 		DataType Type;
 		size_t Dimension;
+		/// 0 for per-vertex data. Otherwise the attribute is read from the
+		/// per-instance data of instanced draws, advancing every `Divisor` instances.
+		uint32_t Divisor = 0;
+		/// Integer components are read as floats in [0, 1], or [-1, 1] for
+		/// signed types. Integer attributes without it feed integer inputs.
+		bool Normalized = false;
+
 		static size_t GetElementSize(DataType type) {
 			switch (type) {
 			case DataType::Float32: return 4;
@@ -192,37 +375,161 @@ namespace av::graphics {
 			case DataType::UInt8: return 1;
 			case DataType::Uniform_Sampler2D: return 4;
 			case DataType::Uniform_SamplerCube: return 4;
+			case DataType::Half16: return 2;
+			case DataType::Int_2_10_10_10_Rev: return 4;
+			case DataType::UInt_2_10_10_10_Rev: return 4;
 			}
 		}
+		/// Whether one element holds every component rather than one.
+		static bool IsPackedType(DataType type) {
+			return type == DataType::Int_2_10_10_10_Rev || type == DataType::UInt_2_10_10_10_Rev;
+		}
+		static bool IsIntegerType(DataType type) {
+			return type >= DataType::Int8 && type <= DataType::UInt64;
+		}
 		size_t GetElementSize() const { return GetElementSize(Type); }
-		size_t GetPackedSize() const { return GetElementSize() * Dimension; }
+		size_t GetPackedSize() const { return IsPackedType(Type) ? GetElementSize() : GetElementSize() * Dimension; }
+		/// Whether the shader sees integers, rather than floats converted from the data.
+		bool IsInteger() const { return IsIntegerType(Type) && !Normalized; }
 	};
 
+	/// Rounds to the nearest half float, saturating to infinity.
+	inline uint16_t FloatToHalf(float value) {
+		uint32_t bits;
+		CopyItems((uint8_t*)&bits, (const uint8_t*)&value, sizeof(bits));
+		uint16_t sign = (bits >> 16) & 0x8000;
+		uint32_t magnitude = bits & 0x7FFFFFFF;
+		if (magnitude > 0x7F800000) return sign | 0x7E00;
+		// 65520 and up round past the largest half.
+		if (magnitude >= 0x477FF000) return sign | 0x7C00;
+		if (magnitude < 0x38800000) {
+			// Below 2^-25 everything rounds to zero, the rest to a subnormal.
+			if (magnitude < 0x33000000) return sign;
+			uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+			uint32_t shift = 126 - (magnitude >> 23);
+			uint32_t half = mantissa >> shift, rest = mantissa & ((1u << shift) - 1), halfway = 1u << (shift - 1);
+			if (rest > halfway || (rest == halfway && (half & 1))) half += 1;
+			return sign | half;
+		}
+		// Rebias the exponent from 127 to 15; a carry out of the mantissa
+		// correctly bumps the exponent.
+		uint32_t half = (magnitude - 0x38000000) >> 13, rest = magnitude & 0x1FFF;
+		if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half += 1;
+		return sign | half;
+	}
+
+	inline float HalfToFloat(uint16_t half) {
+		uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+		uint32_t exponent = (half >> 10) & 0x1F, mantissa = half & 0x3FF;
+		if (exponent == 0) {
+			float value = mantissa * (1.0f / 16777216.0f);
+			return sign ? -value : value;
+		}
+		uint32_t bits = sign | (exponent == 0x1F ? 0x7F800000 : (exponent + 112) << 23) | (mantissa << 13);
+		float value;
+		CopyItems((uint8_t*)&value, (const uint8_t*)&bits, sizeof(value));
+		return value;
+	}
+
+	/// Packs components in [-1, 1] for a normalized Int_2_10_10_10_Rev attribute.
+	inline uint32_t PackSnorm_2_10_10_10_Rev(float x, float y, float z, float w) {
+		auto quantize = [](float value, float scale, uint32_t mask) {
+			value = value < -1.0f ? -1.0f : value > 1.0f ? 1.0f : value;
+			return (uint32_t)(int32_t)__builtin_roundf(value * scale) & mask;
+		};
+		return quantize(x, 511.0f, 0x3FF) | quantize(y, 511.0f, 0x3FF) << 10
+			| quantize(z, 511.0f, 0x3FF) << 20 | quantize(w, 1.0f, 0x3) << 30;
+	}
+
 	struct VertexSpecification {
+		/// Size of one vertex, not counting per-instance attributes.
 		size_t PackedSize() const {
 			size_t total = 0;
 			for (const auto &attribute : Attributes) {
-				total += attribute.GetPackedSize();
+				if (attribute.Divisor == 0) total += attribute.GetPackedSize();
+			}
+			return total;
+		}
+
+		/// Size of one instance's data, made of the attributes with a divisor.
+		size_t InstancePackedSize() const {
+			size_t total = 0;
+			for (const auto &attribute : Attributes) {
+				if (attribute.Divisor != 0) total += attribute.GetPackedSize();
 			}
 			return total;
 		}
 
 		OwningSpan<VertexAttribute> Attributes;
-		DataType IndexType;
+		/// Only read for indexed meshes.
+		DataType IndexType = DataType::UInt16;
 
 		VertexSpecification Copy() const {
 			return VertexSpecification { Attributes.Copy(), IndexType };
 		}
+
+		/// FNV-1a over the layout, for keying caches of per-layout objects.
+		uint64_t Hash() const {
+			uint64_t hash = HashAttributes();
+			for (int i = 0; i < 8; ++i) {
+				hash ^= ((uint64_t)IndexType >> (i * 8)) & 0xFF;
+				hash *= 0x100000001b3;
+			}
+			return hash;
+		}
+
+		/// Hash of the attributes alone, for objects the index type doesn't
+		/// matter to, such as vertex array objects.
+		uint64_t HashAttributes() const {
+			uint64_t hash = 0xcbf29ce484222325;
+			auto mix = [&](uint64_t value) {
+				for (int i = 0; i < 8; ++i) {
+					hash ^= (value >> (i * 8)) & 0xFF;
+					hash *= 0x100000001b3;
+				}
+			};
+			for (const auto &attribute : Attributes) {
+				mix((uint64_t)attribute.Type);
+				mix(attribute.Dimension);
+				mix(attribute.Divisor);
+				mix(attribute.Normalized);
+			}
+			return hash;
+		}
+
+		bool operator==(const VertexSpecification &other) const {
+			return IndexType == other.IndexType && HasSameAttributes(other);
+		}
+
+		bool HasSameAttributes(const VertexSpecification &other) const {
+			if (Attributes.GetCount() != other.Attributes.GetCount()) return false;
+			for (size_t i = 0; i < Attributes.GetCount(); ++i) {
+				const auto &a = Attributes[i], &b = other.Attributes[i];
+				if (a.Type != b.Type || a.Dimension != b.Dimension || a.Divisor != b.Divisor || a.Normalized != b.Normalized) return false;
+			}
+			return true;
+		}
 	};
 
+	class Mesh;
+	class Shader;
+
+	/// What command buffers record in place of mesh and shader pointers. The
+	/// renderer resolves them through its slot maps, so a stream never points
+	/// into freed memory and draws of destroyed resources are just skipped.
+	using MeshHandle = Handle<Mesh>;
+	using ShaderHandle = Handle<Shader>;
+
 	class Mesh {
+		MeshHandle Handle_;
 		bool Indexed_;
 		size_t VertexCount_, IndexCount_;
 		VertexSpecification VertexSpec_;
 
 	public:
-		Mesh(bool indexed, size_t vertexCount, size_t indexCount, const VertexSpecification &spec)
-			: Indexed_(indexed),
+		Mesh(MeshHandle handle, bool indexed, size_t vertexCount, size_t indexCount, const VertexSpecification &spec)
+			: Handle_(handle),
+			  Indexed_(indexed),
 			  VertexCount_(vertexCount),
 				IndexCount_(indexCount),
 				VertexSpec_(spec.Copy()) {
@@ -230,42 +537,302 @@ namespace av::graphics {
 
 		virtual ~Mesh() = default;
 
+		MeshHandle GetHandle() const { return Handle_; }
 		bool IsIndexed() const { return Indexed_; }
 		size_t GetVertexCount() const { return VertexCount_; }
 		size_t GetIndexCount() const { return IndexCount_; }
 		const VertexSpecification &GetVertexSpec() const { return VertexSpec_; }
 	};
 
-	class Shader { };
+	/// Shared vertex and index storage for indexed meshes of one layout. Meshes
+	/// created in the same pool can be drawn together by CmdDrawMeshes.
+	class MeshPool {
+		size_t VertexCapacity_, IndexCapacity_;
+		VertexSpecification VertexSpec_;
+
+	public:
+		MeshPool(const VertexSpecification &spec, size_t vertexCapacity, size_t indexCapacity)
+			: VertexCapacity_(vertexCapacity),
+				IndexCapacity_(indexCapacity),
+				VertexSpec_(spec.Copy()) {
+		}
+
+		virtual ~MeshPool() = default;
+
+		size_t GetVertexCapacity() const { return VertexCapacity_; }
+		size_t GetIndexCapacity() const { return IndexCapacity_; }
+		const VertexSpecification &GetVertexSpec() const { return VertexSpec_; }
+	};
+
+	class Shader {
+		ShaderHandle Handle_;
+
+	public:
+		explicit Shader(ShaderHandle handle) : Handle_(handle) {}
+		virtual ~Shader() = default;
+
+		ShaderHandle GetHandle() const { return Handle_; }
+	};
+
+	enum class ShaderStatus : uint8_t {
+		/// Still compiling or linking; draws using it are skipped.
+		Compiling,
+		Ready,
+		/// Didn't compile or link; draws using it are skipped for good.
+		Failed
+	};
+
+	/// Immutable, prevalidated commands recorded once and replayed any number
+	/// of times through CmdExecuteBundle.
+	class Bundle {
+		size_t CommandCount_;
+
+	public:
+		Bundle(size_t commandCount) : CommandCount_(commandCount) {}
+		virtual ~Bundle() = default;
+
+		size_t GetCommandCount() const { return CommandCount_; }
+	};
+
+	/// Small integer standing in for a uniform name. Interning takes a lock, so
+	/// intern names once up front and record the id.
+	class UniformId {
+	public:
+		UniformId() : Value_(InvalidValue_) {}
+
+		static UniformId Intern(const char *name);
+		static size_t GetInternedCount();
+
+		const char *GetName() const;
+		uint16_t GetValue() const { return Value_; }
+		bool IsValid() const { return Value_ != InvalidValue_; }
+
+		bool operator==(const UniformId &other) const { return Value_ == other.Value_; }
+
+	private:
+		friend class CommandBufferReader;
+
+		static constexpr uint16_t InvalidValue_ = 0xFFFF;
+
+		explicit UniformId(uint16_t value) : Value_(value) {}
+
+		uint16_t Value_;
+	};
+
+	/// Small integer standing in for a profiler marker name, interned like
+	/// UniformId.
+	class MarkerId {
+	public:
+		MarkerId() : Value_(InvalidValue_) {}
+
+		static MarkerId Intern(const char *name);
+
+		const char *GetName() const;
+		uint16_t GetValue() const { return Value_; }
+		bool IsValid() const { return Value_ != InvalidValue_; }
+
+		bool operator==(const MarkerId &other) const { return Value_ == other.Value_; }
+
+	private:
+		friend class CommandBufferReader;
+
+		static constexpr uint16_t InvalidValue_ = 0xFFFF;
+
+		explicit MarkerId(uint16_t value) : Value_(value) {}
+
+		uint16_t Value_;
+	};
+
+	/// Memory command buffers write uniform block data into while recording,
+	/// typically mapped GPU memory the renderer provides for one frame.
+	class UniformArena {
+	public:
+		struct Allocation {
+			/// Null if the arena is full.
+			uint8_t *Ptr;
+			uint32_t Offset;
+		};
+
+		virtual ~UniformArena() = default;
+
+		/// Must be safe to call from several recording threads at once.
+		virtual Allocation Allocate(size_t size) = 0;
+	};
+
+	/// Caller-provided part of a draw's sort key. The shader and mesh bits are
+	/// filled in by the command buffer from their handles' slot indices.
+	/// Layout, from the most significant bit: pass (4), shader (16),
+	/// material (12), mesh (16), depth (16).
+	struct DrawKey {
+		uint8_t Pass = 0;
+		uint16_t Material = 0;
+		/// In [0, 1], quantized to 16 bits.
+		float Depth = 0.0f;
+	};
+
+	class Renderer;
+	class MeshUploadQueue;
 
 	class CommandBuffer {
 	public:
+		/// Uniform payloads up to this size stay inline in the command stream.
+		static constexpr size_t MaxInlineUniformSize = 64;
+
 		void CmdClear(float r, float g, float b, float a);
 		void CmdBindShader(Ref<Shader> shader);
-		void CmdDrawMesh(Ref<Mesh> mesh);
-		void CmdUniform(const char *name, void *value, DataType type, int sizeX = 1, int sizeY = 1);
+		/// Meshes with per-instance attributes can only be drawn instanced;
+		/// other draws of them are reported and dropped.
+		void CmdDrawMesh(Ref<Mesh> mesh, const DrawKey &key = {});
+
+		/// Draws the meshes in order. Consecutive meshes from the same MeshPool
+		/// are submitted together with a single multi-draw-indirect call.
+		/// Meshes with per-instance attributes are dropped, as in CmdDrawMesh.
+		void CmdDrawMeshes(Span<const Ref<Mesh>> meshes);
+
+		/// Draws `instanceCount` instances of the mesh. `instanceData` holds one
+		/// InstancePackedSize()-sized entry per instance, laid out as described
+		/// by the attributes with a divisor; it is copied into the buffer.
+		/// Draws with less data than that are reported and dropped.
+		void CmdDrawMeshInstanced(Ref<Mesh> mesh, Span<const uint8_t> instanceData, uint32_t instanceCount);
+		/// Sets a uniform array of `count` elements, each a sizeX by sizeY
+		/// vector or matrix of `type`. Payloads of any size are supported;
+		/// large ones are kept in a side arena instead of the command stream.
+		void CmdUniformArray(
+			UniformId id, const void *values, uint32_t count,
+			DataType type, int sizeX = 1, int sizeY = 1
+		);
+
+		void CmdUniform(UniformId id, const void *value, DataType type, int sizeX = 1, int sizeY = 1) {
+			CmdUniformArray(id, value, 1, type, sizeX, sizeY);
+		}
+
+		/// Binds `size` bytes of uniform block data to `binding` for the draws
+		/// that follow, and returns where to write them. With a uniform arena
+		/// set, the data goes straight into it; otherwise into the side arena,
+		/// to be copied at submission. The pointer is only good until the next
+		/// command is recorded, which may grow the side arena, so fill the
+		/// block before recording anything else.
+		uint8_t *CmdUniformBlock(uint32_t binding, size_t size);
+
+		void CmdUniformBlock(uint32_t binding, const void *data, size_t size) {
+			CopyItems(CmdUniformBlock(binding, size), (const uint8_t*)data, size);
+		}
+
+		/// Replays the bundle as if its commands had been recorded here. It sees
+		/// and changes the same state, such as the bound shader.
+		void CmdExecuteBundle(Ref<Bundle> bundle);
+
+		/// Opens and closes a profiled scope. Scopes nest, and backends with a
+		/// profiler time the commands between them; others ignore them.
+		void CmdBeginMarker(MarkerId id);
+		void CmdEndMarker();
 		
-		void CmdUniform(const char *name, float x) {
-			CmdUniform(name, &x, DataType::Float32, 1, 1);
+		void CmdUniform(UniformId id, float x) {
+			CmdUniform(id, &x, DataType::Float32, 1, 1);
 		}
 		
-		void CmdUniform(const char *name, float x, float y) {
+		void CmdUniform(UniformId id, float x, float y) {
 			float v[2] = { x, y };
-			CmdUniform(name, v, DataType::Float32, 2, 1);
+			CmdUniform(id, v, DataType::Float32, 2, 1);
 		}
 		
-		void CmdUniform(const char *name, float x, float y, float z) {
+		void CmdUniform(UniformId id, float x, float y, float z) {
 			float v[3] = { x, y, z };
-			CmdUniform(name, v, DataType::Float32, 3, 1);
+			CmdUniform(id, v, DataType::Float32, 3, 1);
 		}
 
+		/// Recording more after End reopens the buffer: the End goes away and
+		/// the buffer has to be ended again.
 		void End();
+		bool IsEnded() const { return Ended_; }
+
+		/// In sorted mode End() reorders draws by their sort key. Draws only move
+		/// within runs that contain nothing but draws and shader binds; any other
+		/// command (clears, uniforms, markers) stays in place and acts as a barrier, as do
+		/// draws that rely on a shader bound before this buffer. Draws recorded
+		/// while sorting was off have no key and act as barriers too.
+		void SetSorted(bool sorted) { Sorted_ = sorted; }
+		bool IsSorted() const { return Sorted_; }
+
+		/// Set by the renderer for the buffers it hands out each frame.
+		void SetUniformArena(UniformArena *arena) { UniformArena_ = arena; }
+		UniformArena *GetUniformArena() const { return UniformArena_; }
+
+		/// With a validator, draws are checked against the vertex inputs of the
+		/// shader bound in this buffer as they are recorded. Draws that don't
+		/// fit are reported and dropped. See Renderer::SetRecordValidation.
+		void SetValidator(const Renderer *renderer) { Validator_ = renderer; }
+		size_t GetDroppedDrawCount() const { return DroppedDraws_; }
+
+		/// Makes sure at least `bytes` bytes can be recorded without reallocating.
+		void Reserve(size_t bytes) { Data_.Reserve(bytes); }
+
+		/// Drops all recorded commands, but keeps the allocation for the next frame.
+		void Reset() {
+			Data_.Clear(); Arena_.Clear(); DrawKeys_.Clear(); Count_ = 0; DrawCount_ = 0;
+			ValidatedShader_ = nullptr; DroppedDraws_ = 0; Ended_ = false;
+		}
 
 		Span<const uint8_t> GetData() const { return { Data_.GetData(), Data_.GetCount() }; }
+		/// Large payloads referenced from the command stream by offset.
+		Span<const uint8_t> GetArena() const { return { Arena_.GetData(), Arena_.GetCount() }; }
 		size_t GetCount() const { return Count_; }
+		size_t GetCapacity() const { return Data_.GetCapacity(); }
+	private:
+		struct SortItem_ {
+			uint64_t Key;
+			MeshHandle DrawnMesh;
+			ShaderHandle BoundShader;
+		};
+
+		uint8_t *Push_(size_t bytes) {
+			if (Ended_) Reopen_();
+			return Data_.Extend(bytes);
+		}
+		/// Drops the End command, always the last one of an ended buffer.
+		void Reopen_();
+		/// False if the validator rejects drawing `mesh` with the bound shader.
+		bool ValidateDraw_(const Mesh *mesh);
+		/// False if `mesh` has per-instance attributes, which a plain draw
+		/// would read from whatever instance data was bound last.
+		bool ValidatePlainDraw_(const Mesh *mesh);
+
+		void PushBindShader_(ShaderHandle shader);
+		void PushDrawMesh_(MeshHandle mesh);
+		void SortDraws_();
+		void EmitSortedDraws_(ShaderHandle &emittedShader);
+
+		size_t Count_ = 0;
+		bool Sorted_ = false, Ended_ = false;
+		UniformArena *UniformArena_ = nullptr;
+		GrowingSpan<uint8_t> Data_, Arena_;
+
+		const Renderer *Validator_ = nullptr;
+		/// Last shader bound in this buffer, null before the first bind or
+		/// after a bundle, which may have bound another.
+		const Shader *ValidatedShader_ = nullptr;
+		size_t DroppedDraws_ = 0;
+
+		// Sorted mode only, kept between frames like Data_. DrawKeys_ is
+		// indexed by DrawMesh command; draws recorded unsorted get NoDrawKey_.
+		static constexpr uint64_t NoDrawKey_ = ~uint64_t(0);
+		size_t DrawCount_ = 0;
+		GrowingSpan<uint64_t> DrawKeys_;
+		GrowingSpan<SortItem_> SortItems_, SortScratch_;
+		GrowingSpan<uint8_t> Unsorted_;
+	};
+
+	/// Records a BeginMarker now and the matching EndMarker at end of scope.
+	class ScopedMarker {
+	public:
+		ScopedMarker(Ref<CommandBuffer> cmdBuf, MarkerId id) : CmdBuf_(cmdBuf) { CmdBuf_->CmdBeginMarker(id); }
+		~ScopedMarker() { CmdBuf_->CmdEndMarker(); }
+
+		ScopedMarker(const ScopedMarker &) = delete;
+		ScopedMarker &operator=(const ScopedMarker &) = delete;
+
 	private:
-		size_t Count_ = 0, Offset_ = 0;
-		OwningSpan<uint8_t> Data_;
+		Ref<CommandBuffer> CmdBuf_;
 	};
 
 	class Renderer {
@@ -281,14 +848,165 @@ namespace av::graphics {
 			const VertexSpecification &spec
 		) = 0;
 
+		virtual Owned<MeshPool> CreateMeshPool(
+			const VertexSpecification &spec,
+			size_t vertexCapacity,
+			size_t indexCapacity
+		) = 0;
+
+		/// Creates an indexed mesh inside the pool, using the pool's layout.
+		/// Returns a null mesh if the pool has no room left.
+		virtual Owned<Mesh> CreateMesh(
+			Ref<MeshPool> pool,
+			Span<uint8_t> vertexData,
+			Span<uint8_t> indexData
+		) = 0;
+
+		/// Returns right away; the program may still be compiling in the
+		/// background. Use GetShaderStatus to find out how it went.
 		virtual Owned<Shader> CreateShader(const char *vertexSource, const char *fragmentSource) = 0;
+		virtual ShaderStatus GetShaderStatus(Ref<Shader> shader) = 0;
+
+		/// Whether meshes of `spec` can feed the vertex inputs of `shader`. On
+		/// mismatch, describes it in `reason`. Backends without shader
+		/// reflection, or whose program is still compiling, accept anything.
+		/// Called from recording threads, so it must not change any state.
+		virtual bool CheckVertexInputs(const Shader *shader, const VertexSpecification &spec, Span<char> reason) const {
+			return true;
+		}
+
+		/// Makes the command buffers handed out from the next frame on check
+		/// every draw with CheckVertexInputs. Off by default.
+		void SetRecordValidation(bool enabled) { RecordValidation_ = enabled; }
+
+		/// Validates and decodes an ended command buffer into a bundle. The
+		/// buffer can be reset or reused afterwards. Returns a null bundle if
+		/// the buffer is malformed.
+		virtual Owned<Bundle> CreateBundle(Ref<CommandBuffer> cmdBuf) = 0;
+		virtual void DestroyBundle(Owned<Bundle> &&bundle) = 0;
 
+		/// Destroying resources used by frames still in flight is fine; the
+		/// backend holds on to the GPU side until those frames retire.
 		virtual void DestroyMesh(Owned<Mesh> &&mesh) = 0;
+		/// All meshes created in the pool must have been destroyed first.
+		virtual void DestroyMeshPool(Owned<MeshPool> &&pool) = 0;
 		virtual void DestroyShader(Owned<Shader> &&shader) = 0;
 
-		virtual void FlushCommandBuffer(Ref<CommandBuffer>) = 0;
+		/// Replays the buffers in order, as if they had been recorded into one.
+		/// State such as the bound shader carries over from one buffer to the next.
+		virtual void FlushCommandBuffers(Span<const Ref<CommandBuffer>> cmdBufs) = 0;
+
+		void FlushCommandBuffer(Ref<CommandBuffer> cmdBuf) {
+			FlushCommandBuffers({ &cmdBuf, 1 });
+		}
 
 		virtual void Initialize() = 0;
 		virtual void DeInitialize() = 0;
+
+		static constexpr size_t FramesInFlight = 3;
+		static constexpr size_t MaxWorkerCommandBuffers = 16;
+
+		/// Hands out the command buffer of the next frame in the ring, reset and
+		/// ready for recording. Waits for the frame that last used it to retire.
+		Ref<CommandBuffer> BeginFrame() {
+			size_t slot = GetFrameSlot();
+			WaitForFrame_(slot);
+			return ResetFrame_(slot);
+		}
+
+		/// Hands out `count` more command buffers for the current frame, one per
+		/// recording thread. Call once after BeginFrame, from the thread that
+		/// owns the renderer; each worker then records into its own buffer and
+		/// ends it. EndFrame submits them after the primary one, in index order.
+		/// At most MaxWorkerCommandBuffers; asking for more is a bug, and
+		/// release builds report it and hand out that many.
+		Span<CommandBuffer> BeginWorkerCommandBuffers(size_t count);
+
+		/// Submits the command buffers handed out by BeginFrame and
+		/// BeginWorkerCommandBuffers in a single pass.
+		void EndFrame() {
+			SubmitFrame_(GetFrameSlot(), FrameIndex_);
+			FrameIndex_ += 1;
+		}
+
+		uint64_t GetFrameIndex() const { return FrameIndex_; }
+		size_t GetFrameSlot() const { return FrameIndex_ % FramesInFlight; }
+
+	protected:
+		// With a RenderThread, WaitForFrame_, BeginSubmit_ and SignalFrame_ run
+		// on the render thread and BeginUniformArena_ on the recording thread,
+		// possibly while an earlier frame is being submitted.
+
+		/// Blocks until the GPU has finished the frame last submitted in `slot`.
+		virtual void WaitForFrame_(size_t slot) = 0;
+		/// Readies the uniform memory of `slot` for recording and returns it,
+		/// if the backend has any. Called after WaitForFrame_(slot); must not
+		/// touch the graphics API.
+		virtual UniformArena *BeginUniformArena_(size_t slot) { return nullptr; }
+		/// Called right before the frame in `slot` is flushed.
+		virtual void BeginSubmit_(size_t slot) {}
+		/// Called after frame number `frame` has been submitted from `slot`.
+		virtual void SignalFrame_(size_t slot, uint64_t frame) = 0;
+
+		/// Creates a mesh for MeshUploadQueue, between BeginSubmit_ and the
+		/// flush. Backends with staging memory copy through it.
+		virtual Owned<Mesh> UploadMesh_(
+			Span<uint8_t> vertexData,
+			Span<uint8_t> indexData,
+			bool indexed,
+			const VertexSpecification &spec
+		) {
+			return indexed ? CreateMesh(vertexData, indexData, spec) : CreateMesh(vertexData, spec);
+		}
+		/// Makes room for uploading `bytesPerFrame` bytes in every frame.
+		virtual void ReserveUploadStaging_(size_t bytesPerFrame) {}
+
+	private:
+		friend class RenderThread;
+		friend class MeshUploadQueue;
+
+		struct Frame_ {
+			CommandBuffer Primary;
+			CommandBuffer Workers[MaxWorkerCommandBuffers];
+			size_t WorkerCount = 0;
+			UniformArena *Arena = nullptr;
+		};
+
+		Ref<CommandBuffer> ResetFrame_(size_t slot) {
+			auto &frame = Frames_[slot];
+			frame.Arena = BeginUniformArena_(slot);
+			frame.Primary.Reset();
+			frame.Primary.SetUniformArena(frame.Arena);
+			frame.Primary.SetValidator(RecordValidation_ ? this : nullptr);
+			frame.WorkerCount = 0;
+			return &frame.Primary;
+		}
+
+		void SubmitFrame_(size_t slot, uint64_t frameIndex) {
+			auto &frame = Frames_[slot];
+			Ref<CommandBuffer> cmdBufs[1 + MaxWorkerCommandBuffers];
+			cmdBufs[0] = &frame.Primary;
+			for (size_t i = 0; i < frame.WorkerCount; ++i) {
+				cmdBufs[1 + i] = &frame.Workers[i];
+			}
+			EndUnterminated_({ cmdBufs, 1 + frame.WorkerCount }, frameIndex);
+			BeginSubmit_(slot);
+			ProcessUploads_();
+			FlushCommandBuffers({ cmdBufs, 1 + frame.WorkerCount });
+			SignalFrame_(slot, frameIndex);
+		}
+
+		/// Reports and ends the buffers that have commands but weren't ended.
+		static void EndUnterminated_(Span<Ref<CommandBuffer>> cmdBufs, uint64_t frameIndex);
+		/// Defined with MeshUploadQueue.
+		void ProcessUploads_();
+
+		uint64_t FrameIndex_ = 0;
+		bool RecordValidation_ = false;
+		Frame_ Frames_[FramesInFlight];
+		/// Attached and detached from other threads than the one submitting,
+		/// which flags when it's using the queue so detaching can wait it out.
+		std::atomic<MeshUploadQueue*> UploadQueue_ = nullptr;
+		std::atomic<bool> ProcessingUploads_ = false;
 	};
 }
@@ -0,0 +1,63 @@
+#pragma once
+#include <av/av.hh>
+
+namespace av::graphics {
+	struct MeshOptimizeOptions {
+		/// Merges vertices whose bytes are identical, which turns unindexed
+		/// triangle soup into an indexed mesh.
+		bool Weld = true;
+		/// Reorders triangles for the post-transform vertex cache (Forsyth).
+		bool OptimizeVertexCache = true;
+		/// Then reorders clusters of those triangles so outward facing ones
+		/// draw first, as long as a cluster's cache misses stay within
+		/// OverdrawThreshold times what they were. Needs attribute 0 to be a
+		/// per-vertex Float32, Float64 or Half16 position of at least three components.
+		bool OptimizeOverdraw = true;
+		float OverdrawThreshold = 1.05f;
+		/// FIFO cache the ACMR is measured with and overdraw clusters are cut by.
+		size_t CacheSize = 16;
+	};
+
+	struct MeshOptimizeStats {
+		size_t InputVertexCount = 0, OutputVertexCount = 0, TriangleCount = 0;
+		/// Average cache miss ratio, vertices transformed per triangle, of the
+		/// input and of the output. 3 is the worst, 0.5 the best for large meshes.
+		float AcmrBefore = 0.0f, AcmrAfter = 0.0f;
+	};
+
+	struct OptimizedMesh {
+		GrowingSpan<uint8_t> VertexData;
+		GrowingSpan<uint8_t> IndexData;
+		/// UInt16 if every vertex index fits below the 0xFFFF restart index, otherwise UInt32.
+		DataType IndexType = DataType::UInt16;
+		MeshOptimizeStats Stats;
+	};
+
+	/// Optimizes CreateMesh inputs: welds vertices, drops degenerate
+	/// triangles, reorders triangles for the vertex cache and overdraw, then
+	/// reorders vertices in first use order. Leave `indexData` empty for
+	/// unindexed triangles; instance attributes are not part of `vertexData`.
+	/// Triangles with indices past the end of `vertexData` are dropped.
+	void OptimizeMesh(
+		Span<const uint8_t> vertexData,
+		Span<const uint8_t> indexData,
+		const VertexSpecification &spec,
+		OptimizedMesh &out,
+		const MeshOptimizeOptions &options = {}
+	);
+
+	/// Average cache miss ratio of drawing `indices` through a FIFO cache of
+	/// `cacheSize`. Indices of `vertexCount` and up are not counted.
+	float ComputeAcmr(Span<const uint32_t> indices, size_t vertexCount, size_t cacheSize);
+
+	/// Runs OptimizeMesh and creates the result with the picked index type.
+	/// `stats` is filled in if not null.
+	Owned<Mesh> CreateOptimizedMesh(
+		Renderer &renderer,
+		Span<const uint8_t> vertexData,
+		Span<const uint8_t> indexData,
+		const VertexSpecification &spec,
+		const MeshOptimizeOptions &options = {},
+		MeshOptimizeStats *stats = nullptr
+	);
+}
@@ -0,0 +1,125 @@
+#pragma once
+#include <av/av.hh>
+#include <atomic>
+
+namespace av::graphics {
+	/// Uniform arena in plain memory, laid out like the GPU ring it stands in for.
+	/// Shared by the backends that run without a GPU.
+	class Null_UniformArena : public UniformArena {
+	public:
+		void Create(size_t regionSize);
+		void BeginFrame(size_t slot);
+
+		Allocation Allocate(size_t size) override;
+
+		/// Backing memory; allocation offsets index into it.
+		Span<const uint8_t> GetMemory() const { return Memory_; }
+
+	private:
+		OwningSpan<uint8_t> Memory_;
+		size_t RegionSize_ = 0, Slot_ = 0;
+		std::atomic<size_t> Cursor_ = 0;
+	};
+
+	class Null_MeshPool;
+
+	/// What the accounting needs of a mesh, packed in the renderer's slot map.
+	struct Null_MeshRecord {
+		/// Set for meshes living in a pool.
+		Null_MeshPool *Pool;
+		uint32_t VertexCount, IndexCount;
+		/// VertexSpecification::Hash of the layout.
+		uint64_t Layout;
+		bool Indexed;
+	};
+
+	/// Renderer that decodes and accounts for every command without a GPU, for
+	/// profiling recording, culling and meshing where there is no GL context.
+	class Null_Renderer : public Renderer {
+	public:
+		struct Stats {
+			size_t Commands = 0;
+			/// Meshes drawn, counting every mesh of a batched draw.
+			size_t Draws = 0;
+			/// Calls a GPU backend would have to make for those draws.
+			size_t DrawCalls = 0;
+			size_t Instances = 0, Triangles = 0;
+			size_t ShaderBinds = 0, ShaderChanges = 0;
+			size_t MeshChanges = 0;
+			size_t Uniforms = 0, UniformBytes = 0;
+			size_t UniformBlocks = 0, UniformBlockBytes = 0;
+			size_t Clears = 0, BundlesExecuted = 0, Markers = 0;
+			/// Command stream and side arena bytes submitted.
+			size_t StreamBytes = 0, ArenaBytes = 0;
+			/// Draws skipped because their mesh had been destroyed.
+			size_t StaleDraws = 0;
+
+			Stats &operator+=(const Stats &other);
+		};
+
+		virtual Owned<Mesh> CreateMesh(
+			Span<uint8_t> vertexData,
+			Span<uint8_t> indexData,
+			const VertexSpecification &spec
+		) override;
+
+		virtual Owned<Mesh> CreateMesh(
+			Span<uint8_t> vertexData,
+			const VertexSpecification &spec
+		) override;
+
+		Owned<MeshPool> CreateMeshPool(
+			const VertexSpecification &spec,
+			size_t vertexCapacity,
+			size_t indexCapacity
+		) override;
+
+		Owned<Mesh> CreateMesh(
+			Ref<MeshPool> pool,
+			Span<uint8_t> vertexData,
+			Span<uint8_t> indexData
+		) override;
+
+		Owned<Shader> CreateShader(const char *vertexSource, const char *fragmentSource) override;
+		/// Shaders aren't compiled, so they are always ready.
+		ShaderStatus GetShaderStatus(Ref<Shader> shader) override { return ShaderStatus::Ready; }
+
+		Owned<Bundle> CreateBundle(Ref<CommandBuffer> cmdBuf) override;
+		void DestroyBundle(Owned<Bundle> &&bundle) override;
+
+		void DestroyMesh(Owned<Mesh> &&mesh) override;
+		void DestroyMeshPool(Owned<MeshPool> &&pool) override;
+		void DestroyShader(Owned<Shader> &&shader) override;
+
+		void FlushCommandBuffers(Span<const Ref<CommandBuffer>> cmdBufs) override;
+
+		void Initialize() override;
+		void DeInitialize() override;
+
+		static constexpr size_t UniformArenaSize = 4 * 1024 * 1024;
+
+		/// Accounting of the last flush, and of every flush since Initialize.
+		const Stats &GetLastStats() const { return Last_; }
+		const Stats &GetTotalStats() const { return Total_; }
+
+	protected:
+		void WaitForFrame_(size_t slot) override;
+		UniformArena *BeginUniformArena_(size_t slot) override;
+		void SignalFrame_(size_t slot, uint64_t frame) override;
+
+	private:
+		struct Executor_ {
+			Stats &Counts;
+			ShaderHandle BoundShader;
+			MeshHandle LastMesh;
+		};
+
+		void Execute_(Executor_ &executor, Span<const uint8_t> data, Span<const uint8_t> arena);
+
+		SlotMap<Mesh, Null_MeshRecord> Meshes_;
+		/// Shaders have no state here; the map only hands out handles.
+		SlotMap<Shader, const Shader*> Shaders_;
+		Null_UniformArena UniformArena_;
+		Stats Last_, Total_;
+	};
+}
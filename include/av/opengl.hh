@@ -1,7 +1,382 @@
 #pragma once
 #include <av/av.hh>
+#include <atomic>
+#include <unordered_map>
+
+struct __GLsync;
 
 namespace av::graphics {
+	/// Shadow copy of the GL state the renderer touches. Calls that would not
+	/// change anything are dropped and counted instead of reaching the driver.
+	class OpenGL_StateCache {
+	public:
+		enum class BufferTarget : uint8_t {
+			Array, DrawIndirect, Uniform, CopyRead, CopyWrite, Count_
+		};
+
+		static constexpr size_t MaxUniformBindings = 16;
+
+		struct Stats {
+			size_t Issued = 0, Skipped = 0;
+		};
+
+		OpenGL_StateCache() { Invalidate(); }
+
+		void UseProgram(uint32_t program);
+		void BindVertexArray(uint32_t vao);
+		void BindBuffer(BufferTarget target, uint32_t buffer);
+		void BindUniformBufferRange(uint32_t index, uint32_t buffer, size_t offset, size_t size);
+		void ClearColor(float r, float g, float b, float a);
+
+		/// Forgets everything, so the next call of each kind reaches the driver.
+		void Invalidate();
+
+		void OnProgramDeleted(uint32_t program);
+		void OnVertexArrayDeleted(uint32_t vao);
+		void OnBufferDeleted(uint32_t buffer);
+
+		const Stats &GetStats() const { return Stats_; }
+		void ResetStats() { Stats_ = {}; }
+
+	private:
+		static constexpr uint32_t Unknown_ = 0xFFFFFFFF;
+
+		struct BufferRange_ {
+			uint32_t Buffer;
+			size_t Offset, Size;
+		};
+
+		uint32_t Program_;
+		uint32_t VertexArray_;
+		uint32_t Buffers_[(size_t)BufferTarget::Count_];
+		BufferRange_ UniformRanges_[MaxUniformBindings];
+		float ClearColor_[4];
+		Stats Stats_;
+	};
+
+	/// Persistently mapped buffer split into one region per frame in flight.
+	/// Allocations come from the current frame's region; the frame fences
+	/// guarantee the GPU is done with a region before it is handed out again.
+	class OpenGL_StreamBuffer {
+	public:
+		struct Allocation {
+			/// Null if the region is full.
+			uint8_t *Ptr;
+			size_t Offset;
+		};
+
+		void Create(size_t regionSize);
+		void Destroy();
+
+		/// Starts handing out the region of `slot`, whose frame has retired.
+		void BeginFrame(size_t slot);
+
+		/// `alignment` doesn't need to be a power of two. Safe to call from
+		/// several threads at once.
+		Allocation Allocate(size_t size, size_t alignment);
+
+		uint32_t GetBuffer() const { return Buffer_; }
+
+	private:
+		uint32_t Buffer_ = 0;
+		uint8_t *Mapped_ = nullptr;
+		size_t RegionSize_ = 0, Slot_ = 0;
+		std::atomic<size_t> Cursor_ = 0;
+	};
+
+	/// Stream buffer for uniform blocks that command buffers write into while
+	/// recording. Draws bind ranges of it with glBindBufferRange. Only the
+	/// recording side allocates from it; blocks copied at submission go into
+	/// the renderer's stream buffer instead.
+	class OpenGL_UniformRing : public UniformArena {
+	public:
+		void Create(size_t regionSize);
+		void Destroy() { Stream_.Destroy(); }
+		void BeginFrame(size_t slot) { Stream_.BeginFrame(slot); }
+
+		Allocation Allocate(size_t size) override;
+
+		uint32_t GetBuffer() const { return Stream_.GetBuffer(); }
+		/// GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
+		size_t GetAlignment() const { return Alignment_; }
+
+	private:
+		OpenGL_StreamBuffer Stream_;
+		size_t Alignment_ = 256;
+	};
+
+	/// One VAO per distinct vertex layout, shared by every pool and heap block
+	/// of that layout. Draws attach their buffers to it with
+	/// glVertexArrayVertexBuffer/ElementBuffer instead of switching VAOs.
+	class OpenGL_VertexArrayCache {
+	public:
+		struct Layout {
+			VertexSpecification Spec;
+			uint32_t VAO;
+			/// Buffers currently attached, so repeated draws skip the calls.
+			uint32_t VertexBuffer = 0, IndexBuffer = 0;
+
+			/// Forgets a buffer that is about to be deleted, whose name GL may reuse.
+			void Detach(uint32_t buffer) {
+				if (VertexBuffer == buffer) VertexBuffer = 0;
+				if (IndexBuffer == buffer) IndexBuffer = 0;
+			}
+		};
+
+		struct Stats {
+			size_t Layouts = 0;
+			/// Buffer attachments made and skipped because they were current.
+			size_t Attached = 0, Skipped = 0;
+		};
+
+		/// Returns the layout matching `spec`, creating its VAO on first use.
+		Layout *Acquire(const VertexSpecification &spec);
+		/// Binds the layout's VAO with the given buffers attached.
+		void Bind(OpenGL_StateCache &state, Layout *layout, uint32_t vertexBuffer, uint32_t indexBuffer);
+		void Destroy(OpenGL_StateCache &state);
+
+		const Stats &GetStats() const { return Stats_; }
+
+	private:
+		std::unordered_multimap<uint64_t, Layout*> Layouts_;
+		Stats Stats_;
+	};
+
+	/// Linked programs saved with glGetProgramBinary, one file per program in
+	/// a cache directory. Files are keyed by a hash of the shader sources and
+	/// the driver's vendor, renderer and version strings, so a driver update
+	/// misses instead of loading a binary the driver would reject.
+	class OpenGL_ProgramCache {
+	public:
+		struct Stats {
+			size_t Hits = 0, Misses = 0;
+			/// Binaries the driver refused; those programs were compiled instead.
+			size_t Rejected = 0;
+			/// Time spent loading binaries and compiling from source.
+			double LoadMs = 0, CompileMs = 0;
+			/// Compile time the hits took when they were cached, minus LoadMs.
+			double SavedMs = 0;
+		};
+
+		/// Reads the driver strings; needs a current context. Without a
+		/// directory, or if the driver has no binary formats, nothing is cached.
+		void Initialize(const char *directory);
+
+		uint64_t ComputeKey(const char *vertexSource, const char *fragmentSource) const;
+
+		/// Returns a linked program, or 0 if there is no usable binary.
+		uint32_t Load(uint64_t key);
+		/// Saves a program linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT.
+		void Store(uint64_t key, uint32_t program, double compileMs);
+
+		bool IsEnabled() const { return Enabled_; }
+		const Stats &GetStats() const { return Stats_; }
+
+	private:
+		void GetPath_(uint64_t key, char *path, size_t size) const;
+
+		bool Enabled_ = false;
+		char Directory_[256] = {};
+		uint64_t DriverHash_ = 0;
+		Stats Stats_;
+	};
+
+	/// Times marker scopes on the GPU with GL_TIMESTAMP queries. Each frame in
+	/// flight has its own set of queries, read back when the renderer reuses
+	/// that frame's slot; its fence has passed by then, so reading never stalls.
+	class OpenGL_GpuProfiler {
+	public:
+		struct MarkerStats {
+			MarkerId Id;
+			/// Samples in the rolling window, at most HistorySize.
+			size_t Samples;
+			double MinMs, AvgMs, P99Ms, LastMs;
+		};
+
+		/// Timestamps per frame, two per scope. Scopes past it go untimed.
+		static constexpr size_t MaxQueriesPerFrame = 512;
+		/// Rolling window of samples per marker.
+		static constexpr size_t HistorySize = 256;
+
+		void Create();
+		void Destroy();
+
+		/// Collects the timings of the last frame recorded in `slot`.
+		void BeginFrame(size_t slot);
+		/// Called as the frame is fenced. Scopes opened outside of a frame,
+		/// such as in flushes of their own, go untimed: nothing would ever
+		/// read their queries back.
+		void EndFrame();
+
+		void Begin(MarkerId id);
+		void End();
+
+		/// Timing is off until enabled; markers are free while it is.
+		void SetEnabled(bool enabled) { Enabled_ = enabled; }
+		bool IsEnabled() const { return Enabled_; }
+
+		/// Fills `out` with the markers that have samples.
+		void GetStats(GrowingSpan<MarkerStats> &out) const;
+		bool WriteCSV(const char *filename) const;
+
+	private:
+		struct Scope_ {
+			MarkerId Id;
+			/// Indices into the frame's queries.
+			uint32_t Begin, End;
+			bool Closed;
+		};
+
+		struct Frame_ {
+			uint32_t Queries[MaxQueriesPerFrame];
+			uint32_t UsedQueries = 0;
+			GrowingSpan<Scope_> Scopes;
+		};
+
+		struct History_ {
+			MarkerId Id;
+			double Samples[HistorySize];
+			double Last;
+			size_t Count, Next;
+		};
+
+		/// Pushed onto Open_ for scopes that aren't being timed.
+		static constexpr size_t Untimed_ = ~size_t(0);
+
+		void Record_(MarkerId id, double ms);
+
+		bool Enabled_ = false, Created_ = false, InFrame_ = false;
+		size_t Slot_ = 0;
+		Frame_ Frames_[Renderer::FramesInFlight];
+		/// Open scopes of the current frame, innermost last.
+		GrowingSpan<size_t> Open_;
+		/// Indexed by MarkerId value.
+		GrowingSpan<History_> Histories_;
+	};
+
+	class OpenGL_MeshPool;
+	class OpenGL_Shader;
+
+	/// Where a mesh lives and how to draw it. Kept packed in the renderer's
+	/// slot map, so flushing reads draws out of one array.
+	struct OpenGL_MeshRecord {
+		/// User-created pool or heap block the mesh's ranges are in.
+		OpenGL_MeshPool *Pool;
+		uint32_t BaseVertex, FirstIndex;
+		uint32_t VertexCount, IndexCount;
+		/// GL type of the indices, 0 for unindexed meshes.
+		uint32_t IndexType;
+		uint32_t IndexSize;
+		/// Size of one instance's data, 0 without per-instance attributes.
+		uint32_t InstanceStride;
+		/// Position in the pool's list of live meshes.
+		uint32_t PoolSlot;
+
+		bool IsIndexed() const { return IndexType != 0; }
+		size_t GetIndexByteOffset() const { return (size_t)FirstIndex * IndexSize; }
+	};
+
+	using OpenGL_MeshMap = SlotMap<Mesh, OpenGL_MeshRecord>;
+
+	/// A mesh's data written to the upload staging buffer, to be copied into
+	/// its pool on the GPU.
+	struct OpenGL_StagedMesh {
+		uint32_t Buffer;
+		size_t VertexOffset, IndexOffset;
+	};
+
+	/// What draws need of a shader; uniform uploads go through Object.
+	struct OpenGL_ShaderRecord {
+		OpenGL_Shader *Object;
+		uint32_t Program;
+		/// Draws are skipped until the program has linked.
+		bool Ready;
+	};
+
+	/// GL objects and mesh ranges released while frames that may still use
+	/// them are in flight. Each release is tagged with the frame being recorded
+	/// and carried out once the renderer sees that frame's fence pass, so the
+	/// driver never has to wait for the GPU to delete or overwrite something.
+	class OpenGL_DeletionQueue {
+	public:
+		/// Frame that releases are tagged with from now on.
+		void SetFrame(uint64_t frame) { Frame_ = frame; }
+
+		void ReleaseBuffer(uint32_t buffer);
+		void ReleaseProgram(uint32_t program);
+		/// Returns a mesh's vertex and index ranges to its pool.
+		void ReleaseRange(OpenGL_MeshPool *pool, size_t baseVertex, size_t vertexCount, size_t firstIndex, size_t indexCount);
+		/// Drops the pending ranges of a pool that is going away or whose
+		/// allocators were rebuilt.
+		void ForgetPool(OpenGL_MeshPool *pool);
+
+		/// Carries out the releases of every frame up to and including `frame`.
+		void Retire(OpenGL_StateCache &state, uint64_t frame);
+		/// Carries out everything; the GPU must be idle.
+		void RetireAll(OpenGL_StateCache &state) { Retire(state, ~uint64_t(0)); }
+
+		size_t GetPendingCount() const { return Entries_.GetCount(); }
+
+	private:
+		enum class Kind_ : uint8_t { None, Buffer, Program, Range };
+
+		struct Entry_ {
+			Kind_ Kind;
+			uint32_t Name;
+			uint64_t Frame;
+			OpenGL_MeshPool *Pool;
+			size_t BaseVertex, VertexCount, FirstIndex, IndexCount;
+		};
+
+		/// In release order, so frames only increase.
+		GrowingSpan<Entry_> Entries_;
+		uint64_t Frame_ = 0;
+	};
+
+	/// Large shared buffers that standalone meshes are carved out of, so that
+	/// thousands of small meshes don't each cost a VAO, two buffers and a bind.
+	/// Each block is a mesh pool owned by the heap; meshes only share a block
+	/// with meshes of the same layout.
+	class OpenGL_MeshHeap {
+	public:
+		struct Stats {
+			size_t Blocks = 0, Meshes = 0;
+			size_t VertexBytes = 0, VertexBytesUsed = 0;
+			size_t IndexBytes = 0, IndexBytesUsed = 0;
+			/// Free ranges that aren't the tail of their block.
+			size_t Holes = 0;
+			/// 1 - largest free range / total free space, over all blocks.
+			float VertexFragmentation = 0, IndexFragmentation = 0;
+		};
+
+		/// Block sizes. A layout's first block starts at the minimum (or the
+		/// size of the mesh that needs it) and later ones double up to the
+		/// full size; a mesh too big for that gets a block of its own size.
+		static constexpr size_t MinVertexBlockSize = 256 * 1024;
+		static constexpr size_t MinIndexBlockSize = 64 * 1024;
+		static constexpr size_t VertexBlockSize = 16 * 1024 * 1024;
+		static constexpr size_t IndexBlockSize = 8 * 1024 * 1024;
+
+		/// Finds room for a mesh, creating a block if none of the layout has
+		/// enough. Returns the block, or null if the allocation failed.
+		OpenGL_MeshPool *Allocate(
+			OpenGL_VertexArrayCache &vaos,
+			const VertexSpecification &spec,
+			size_t vertexCount, size_t indexCount,
+			size_t &baseVertex, size_t &firstIndex
+		);
+
+		/// Moves the meshes of fragmented blocks together and releases empty
+		/// blocks. Meshes keep their handles; only their records' offsets change.
+		void Defragment(OpenGL_DeletionQueue &deletions, OpenGL_MeshMap &meshes);
+		void Destroy(OpenGL_DeletionQueue &deletions);
+
+		Stats GetStats() const;
+
+	private:
+		GrowingSpan<OpenGL_MeshPool*> Blocks_;
+	};
+
 	class OpenGL_Renderer : public Renderer {
 	public:
 		virtual Owned<Mesh> CreateMesh(
@@ -15,14 +390,129 @@ namespace av::graphics {
 			const VertexSpecification &spec
 		) override;
 
+		Owned<MeshPool> CreateMeshPool(
+			const VertexSpecification &spec,
+			size_t vertexCapacity,
+			size_t indexCapacity
+		) override;
+
+		Owned<Mesh> CreateMesh(
+			Ref<MeshPool> pool,
+			Span<uint8_t> vertexData,
+			Span<uint8_t> indexData
+		) override;
+
 		Owned<Shader> CreateShader(const char *vertexSource, const char *fragmentSource) override;
+		ShaderStatus GetShaderStatus(Ref<Shader> shader) override;
+		/// Checks against the inputs reflected at link time. Attribute i feeds
+		/// location i.
+		bool CheckVertexInputs(const Shader *shader, const VertexSpecification &spec, Span<char> reason) const override;
+		/// Compiler and linker output of a program that failed to build.
+		const char *GetShaderLog(Ref<Shader> shader) const;
+
+		Owned<Bundle> CreateBundle(Ref<CommandBuffer> cmdBuf) override;
+		void DestroyBundle(Owned<Bundle> &&bundle) override;
 
 		void DestroyMesh(Owned<Mesh> &&mesh) override;
+		void DestroyMeshPool(Owned<MeshPool> &&pool) override;
 		void DestroyShader(Owned<Shader> &&shader) override;
 
-		void FlushCommandBuffer(Ref<CommandBuffer>) override;
+		/// Called on its own rather than through EndFrame, waits for the
+		/// GPU to finish with the last frame's stream region before reusing it.
+		void FlushCommandBuffers(Span<const Ref<CommandBuffer>> cmdBufs) override;
 
 		void Initialize() override;
 		void DeInitialize() override;
+
+		/// Per-frame budget for data copied at submission: instance data of
+		/// instanced draws, indirect commands of batched draws, and uniform
+		/// blocks from side arenas and bundles.
+		static constexpr size_t StreamSize = 8 * 1024 * 1024;
+		/// Per-frame budget for uniform block data written while recording.
+		static constexpr size_t UniformRingSize = 4 * 1024 * 1024;
+
+		/// Bound-state changes issued and skipped during the last flush.
+		const OpenGL_StateCache::Stats &GetStateStats() const { return State_.GetStats(); }
+		/// Draws dropped in the last flush because their program wasn't ready
+		/// or their mesh had been destroyed.
+		size_t GetSkippedDrawCount() const { return SkippedDraws_; }
+		/// Whether programs compile in the background (KHR_parallel_shader_compile).
+		bool IsCompilingInParallel() const { return ParallelShaderCompile_; }
+
+		/// Compacts the shared mesh buffers. Call between frames, not while
+		/// command buffers are being flushed.
+		void DefragmentMeshHeap() { MeshHeap_.Defragment(Deletions_, Meshes_); }
+		OpenGL_MeshHeap::Stats GetMeshHeapStats() const { return MeshHeap_.GetStats(); }
+		const OpenGL_VertexArrayCache::Stats &GetVertexArrayStats() const { return VertexArrays_.GetStats(); }
+
+		/// Where linked programs are cached between runs. Call before
+		/// Initialize; null (the default) disables the cache.
+		void SetProgramCacheDirectory(const char *directory) { ProgramCacheDirectory_ = directory; }
+		const OpenGL_ProgramCache::Stats &GetProgramCacheStats() const { return ProgramCache_.GetStats(); }
+
+		/// GPU time spent in marker scopes, several frames behind.
+		OpenGL_GpuProfiler &GetGpuProfiler() { return Profiler_; }
+
+		/// Meshes, shaders and buffers waiting for their last frame to retire.
+		size_t GetPendingDeletionCount() const { return Deletions_.GetPendingCount(); }
+
+	protected:
+		void WaitForFrame_(size_t slot) override;
+		UniformArena *BeginUniformArena_(size_t slot) override;
+		void BeginSubmit_(size_t slot) override;
+		void SignalFrame_(size_t slot, uint64_t frame) override;
+		/// Writes the data to the staging ring and copies it into the mesh
+		/// heap from there. Uploads directly if the ring is full.
+		Owned<Mesh> UploadMesh_(
+			Span<uint8_t> vertexData,
+			Span<uint8_t> indexData,
+			bool indexed,
+			const VertexSpecification &spec
+		) override;
+		void ReserveUploadStaging_(size_t bytesPerFrame) override;
+
+	private:
+		/// Places a mesh in `pool`, or in the mesh heap if null. Its data is
+		/// copied from `staged` if set, otherwise uploaded from memory.
+		Owned<Mesh> AddMesh_(
+			OpenGL_MeshPool *pool, bool indexed,
+			Span<uint8_t> vertexData, Span<uint8_t> indexData,
+			const VertexSpecification &spec,
+			const OpenGL_StagedMesh *staged = nullptr
+		);
+		/// Finishes the programs the driver is done compiling.
+		void PollShaders_();
+		/// Carries out pending releases if the GPU is done with every frame,
+		/// which is the case before the first one too. Otherwise they wait
+		/// for WaitForFrame_.
+		void RetireIfIdle_();
+
+		OpenGL_MeshMap Meshes_;
+		SlotMap<Shader, OpenGL_ShaderRecord> Shaders_;
+		OpenGL_StateCache State_;
+		OpenGL_StreamBuffer Stream_;
+		/// Per-frame regions MeshUploadQueue copies meshes through; created
+		/// once a queue reserves them.
+		OpenGL_StreamBuffer Staging_;
+		size_t StagingSize_ = 0;
+		/// Slot of the frame being submitted, or last submitted.
+		size_t SubmitSlot_ = 0;
+		/// Between BeginSubmit_ and SignalFrame_; flushes outside of that
+		/// manage the stream themselves.
+		bool Submitting_ = false;
+		OpenGL_UniformRing UniformRing_;
+		OpenGL_VertexArrayCache VertexArrays_;
+		OpenGL_MeshHeap MeshHeap_;
+		OpenGL_GpuProfiler Profiler_;
+		OpenGL_DeletionQueue Deletions_;
+		OpenGL_ProgramCache ProgramCache_;
+		const char *ProgramCacheDirectory_ = nullptr;
+		bool ParallelShaderCompile_ = false;
+		/// Programs still compiling in the background.
+		GrowingSpan<OpenGL_Shader*> PendingShaders_;
+		size_t SkippedDraws_ = 0;
+		::__GLsync *FrameFences_[FramesInFlight] = {};
+		/// Frame index last submitted in each slot.
+		uint64_t SubmittedFrames_[FramesInFlight] = {};
 	};
 }
@@ -3,32 +3,68 @@
 namespace av::graphics {
 	enum class CommandType : uint8_t {
 		DrawMesh = 0x00, BindShader = 0x01, Uniform = 0x02, Clear = 0x03,
+		DrawMeshInstanced = 0x04, DrawMeshes = 0x05, ExecuteBundle = 0x06,
+		UniformBlock = 0x07, BeginMarker = 0x08, EndMarker = 0x09,
 		End = 0xFF
 	};
 
 	struct UniformData {
 		DataType Type;
 		uint8_t SizeX : 4, SizeY : 4;
-		const char *Name;
+		UniformId Id;
+		/// Number of array elements, 1 for plain uniforms.
+		uint32_t Count;
 		Span<const uint8_t> Data;
 	};
 
+	struct UniformBlockData {
+		uint32_t Binding, Size;
+		/// Whether the data was written into the renderer's uniform arena, at
+		/// ArenaOffset. Otherwise it's in the command buffer's side arena.
+		bool InUniformArena;
+		uint32_t ArenaOffset;
+		Span<const uint8_t> Data;
+	};
+
+	struct InstancedDrawData {
+		MeshHandle DrawnMesh;
+		uint32_t InstanceCount;
+		Span<const uint8_t> InstanceData;
+	};
+
 	struct ClearColor {
 		float r, g, b, a;
 	};
 
+	/// Walks a command stream recorded for a bundle, checking that it's
+	/// ended, that every payload fits in it and in `arena`, and that no
+	/// command references a null object or the uniform arena. Reports the
+	/// first problem and returns false.
+	bool ValidateBundleData(Span<const uint8_t> data, Span<const uint8_t> arena);
+
 	class CommandBufferReader {
 	public:
-		CommandBufferReader(Span<const uint8_t> data) : Data_(data) {}
+		CommandBufferReader(Span<const uint8_t> data, Span<const uint8_t> arena = {})
+			: Data_(data), Arena_(arena) {}
 
 		CommandType ReadType();
-		Mesh *ReadCmdDrawMesh();
-		Shader *ReadCmdBindShader();
+		/// Skips over the payload of a command whose type was just read.
+		void SkipCmd(CommandType type);
+		size_t GetOffset() const { return Offset_; }
+
+		MeshHandle ReadCmdDrawMesh();
+		InstancedDrawData ReadCmdDrawMeshInstanced();
+		Span<const MeshHandle> ReadCmdDrawMeshes();
+		ShaderHandle ReadCmdBindShader();
+		Bundle *ReadCmdExecuteBundle();
 		UniformData ReadCmdUniform();
+		UniformBlockData ReadCmdUniformBlock();
 		ClearColor ReadCmdClear();
+		MarkerId ReadCmdBeginMarker();
+		void ReadCmdEndMarker() {}
 
 	private:
 		size_t Offset_ = 0;
-		Span<const uint8_t> Data_;
+		Span<const uint8_t> Data_, Arena_;
 	};
 }
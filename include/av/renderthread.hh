@@ -0,0 +1,144 @@
+#pragma once
+#include <av/av.hh>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <type_traits>
+
+namespace av {
+	/// Bounded ring for one producer and one consumer thread. Each side only
+	/// writes its own index, so neither takes a lock; the blocking calls sleep
+	/// on the other side's index with atomic wait.
+	template<typename T, size_t Capacity>
+	class SpscQueue {
+		static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+	public:
+		bool TryPush(const T &item) {
+			size_t tail = Tail_.load(std::memory_order_relaxed);
+			if (tail - Head_.load(std::memory_order_acquire) == Capacity) return false;
+			Items_[tail & (Capacity - 1)] = item;
+			Tail_.store(tail + 1, std::memory_order_release);
+			Tail_.notify_one();
+			return true;
+		}
+
+		bool TryPop(T &item) {
+			size_t head = Head_.load(std::memory_order_relaxed);
+			if (head == Tail_.load(std::memory_order_acquire)) return false;
+			item = Items_[head & (Capacity - 1)];
+			Head_.store(head + 1, std::memory_order_release);
+			Head_.notify_one();
+			return true;
+		}
+
+		/// Waits for room if the queue is full.
+		void Push(const T &item) {
+			while (!TryPush(item)) {
+				size_t head = Head_.load(std::memory_order_acquire);
+				if (Tail_.load(std::memory_order_relaxed) - head == Capacity) Head_.wait(head);
+			}
+		}
+
+		/// Waits for an item if the queue is empty.
+		T Pop() {
+			T item;
+			while (!TryPop(item)) {
+				size_t tail = Tail_.load(std::memory_order_acquire);
+				if (Head_.load(std::memory_order_relaxed) == tail) Tail_.wait(tail);
+			}
+			return item;
+		}
+
+	private:
+		alignas(64) std::atomic<size_t> Head_ = 0;
+		alignas(64) std::atomic<size_t> Tail_ = 0;
+		T Items_[Capacity];
+	};
+}
+
+namespace av::graphics {
+	/// Runs a renderer on a thread of its own, which owns the graphics
+	/// context. The recording thread hands each ended frame over through an
+	/// SpscQueue and goes on to record the next one while it is submitted, up
+	/// to FramesInFlight - 1 frames ahead of the render thread.
+	///
+	/// Anything else that reaches the backend (creating and destroying
+	/// resources, shader status) has to run on the render thread too, through
+	/// Invoke or the wrappers below. Those wait for the render thread to get
+	/// to them, after every frame ended before.
+	class RenderThread {
+	public:
+		/// Starts the thread. It calls `start` first, to make the context
+		/// current and initialize the renderer; `present` after every
+		/// submitted frame; and `stop` when stopped, to deinitialize.
+		RenderThread(
+			Renderer &renderer,
+			std::function<void()> start,
+			std::function<void()> present,
+			std::function<void()> stop
+		);
+		~RenderThread() { Stop(); }
+
+		RenderThread(const RenderThread &) = delete;
+		RenderThread &operator=(const RenderThread &) = delete;
+
+		/// Like Renderer::BeginFrame, but only waits for the render thread to
+		/// have retired the slot, not for the previous frame to be submitted.
+		Ref<CommandBuffer> BeginFrame();
+		Span<CommandBuffer> BeginWorkerCommandBuffers(size_t count) { return Renderer_.BeginWorkerCommandBuffers(count); }
+		/// Queues the frame for submission and returns right away.
+		void EndFrame();
+
+		/// Runs `fn` on the render thread and waits for it to return.
+		template<typename F>
+		void Invoke(F &&fn) {
+			Call_([](void *context) { (*(std::remove_reference_t<F>*)context)(); }, (void*)&fn);
+		}
+
+		Owned<Mesh> CreateMesh(Span<uint8_t> vertexData, Span<uint8_t> indexData, const VertexSpecification &spec);
+		Owned<Mesh> CreateMesh(Span<uint8_t> vertexData, const VertexSpecification &spec);
+		Owned<MeshPool> CreateMeshPool(const VertexSpecification &spec, size_t vertexCapacity, size_t indexCapacity);
+		Owned<Mesh> CreateMesh(Ref<MeshPool> pool, Span<uint8_t> vertexData, Span<uint8_t> indexData);
+		Owned<Shader> CreateShader(const char *vertexSource, const char *fragmentSource);
+		Owned<Bundle> CreateBundle(Ref<CommandBuffer> cmdBuf);
+		ShaderStatus GetShaderStatus(Ref<Shader> shader);
+
+		void DestroyMesh(Owned<Mesh> &&mesh);
+		void DestroyMeshPool(Owned<MeshPool> &&pool);
+		void DestroyShader(Owned<Shader> &&shader);
+		void DestroyBundle(Owned<Bundle> &&bundle);
+
+		/// Waits until every ended frame has been submitted.
+		void Finish() { Invoke([] {}); }
+		/// Submits what is queued, runs `stop` and joins the thread.
+		void Stop();
+
+		Renderer &GetRenderer() { return Renderer_; }
+
+	private:
+		struct Job_ {
+			enum class Kind : uint8_t { Submit, Wait, Call, Stop };
+
+			Kind Type;
+			size_t Slot;
+			uint64_t Frame;
+			void (*Fn)(void *context);
+			void *Context;
+			std::atomic<bool> *Done;
+		};
+
+		static constexpr size_t QueueSize_ = 64;
+
+		void Run_();
+		void Call_(void (*fn)(void *context), void *context);
+
+		Renderer &Renderer_;
+		std::function<void()> Start_, Present_, Stop_;
+		SpscQueue<Job_, QueueSize_> Jobs_;
+		/// Frames whose slot the render thread has retired, so that frame
+		/// index ReadyFrames_ - 1 and below can be recorded.
+		std::atomic<uint64_t> ReadyFrames_ = 0;
+		std::thread Thread_;
+	};
+}
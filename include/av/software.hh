@@ -0,0 +1,119 @@
+#pragma once
+#include <av/av.hh>
+#include <av/null.hh>
+
+namespace av::graphics {
+	/// RGBA8 color and float depth in memory. Rows run top to bottom and are
+	/// padded to a multiple of 8 pixels so the rasterizer can work a row in
+	/// 8-wide steps.
+	class Software_Framebuffer {
+	public:
+		void Resize(uint32_t width, uint32_t height);
+
+		uint32_t GetWidth() const { return Width_; }
+		uint32_t GetHeight() const { return Height_; }
+		/// Row pitch in pixels.
+		uint32_t GetStride() const { return Stride_; }
+
+		/// Color is packed as R | G << 8 | B << 16 | A << 24.
+		uint32_t *GetColorRow(uint32_t y) { return Color_.GetData() + y * Stride_; }
+		const uint32_t *GetColorRow(uint32_t y) const { return Color_.GetData() + y * Stride_; }
+		float *GetDepthRow(uint32_t y) { return Depth_.GetData() + y * Stride_; }
+		const float *GetDepthRow(uint32_t y) const { return Depth_.GetData() + y * Stride_; }
+
+		uint32_t GetPixel(uint32_t x, uint32_t y) const { return GetColorRow(y)[x]; }
+
+		/// Writes the color buffer as a binary PPM, for diffing against references.
+		bool WritePPM(const char *filename) const;
+
+	private:
+		uint32_t Width_ = 0, Height_ = 0, Stride_ = 0;
+		GrowingSpan<uint32_t> Color_;
+		GrowingSpan<float> Depth_;
+	};
+
+	class Software_Rasterizer;
+
+	/// Renderer that executes command buffers on the CPU, for regression and
+	/// performance runs on machines without a GPU. Triangles are binned into
+	/// tiles which are rasterized in parallel across all cores, 8 pixels at a
+	/// time with AVX2 where the CPU has it.
+	///
+	/// Shaders aren't compiled: every program behaves like data/shaders/main.vert
+	/// and main.frag. Vertices are transformed by the mat4 at the start of uniform
+	/// block 0 (or the uTransform uniform), position is read from attribute 0 and
+	/// the texture coordinates that drive the color from attribute 2.
+	class Software_Renderer : public Renderer {
+	public:
+		/// A thread count of 0 uses every hardware thread.
+		Software_Renderer(uint32_t width, uint32_t height, size_t threadCount = 0);
+		~Software_Renderer();
+
+		virtual Owned<Mesh> CreateMesh(
+			Span<uint8_t> vertexData,
+			Span<uint8_t> indexData,
+			const VertexSpecification &spec
+		) override;
+
+		virtual Owned<Mesh> CreateMesh(
+			Span<uint8_t> vertexData,
+			const VertexSpecification &spec
+		) override;
+
+		Owned<MeshPool> CreateMeshPool(
+			const VertexSpecification &spec,
+			size_t vertexCapacity,
+			size_t indexCapacity
+		) override;
+
+		Owned<Mesh> CreateMesh(
+			Ref<MeshPool> pool,
+			Span<uint8_t> vertexData,
+			Span<uint8_t> indexData
+		) override;
+
+		Owned<Shader> CreateShader(const char *vertexSource, const char *fragmentSource) override;
+		/// Shaders aren't compiled, so they are always ready.
+		ShaderStatus GetShaderStatus(Ref<Shader> shader) override { return ShaderStatus::Ready; }
+
+		Owned<Bundle> CreateBundle(Ref<CommandBuffer> cmdBuf) override;
+		void DestroyBundle(Owned<Bundle> &&bundle) override;
+
+		void DestroyMesh(Owned<Mesh> &&mesh) override;
+		void DestroyMeshPool(Owned<MeshPool> &&pool) override;
+		void DestroyShader(Owned<Shader> &&shader) override;
+
+		void FlushCommandBuffers(Span<const Ref<CommandBuffer>> cmdBufs) override;
+
+		void Initialize() override;
+		void DeInitialize() override;
+
+		static constexpr size_t UniformArenaSize = 4 * 1024 * 1024;
+		static constexpr uint32_t TileSize = 64;
+
+		const Software_Framebuffer &GetFramebuffer() const;
+
+		/// Depth testing is off by default, matching the OpenGL backend.
+		void SetDepthTest(bool enabled);
+		/// Forces the scalar path, to check it against the AVX2 one.
+		void SetUseSIMD(bool enabled);
+		bool IsUsingSIMD() const;
+
+	protected:
+		void WaitForFrame_(size_t slot) override;
+		UniformArena *BeginUniformArena_(size_t slot) override;
+		void SignalFrame_(size_t slot, uint64_t frame) override;
+
+	private:
+		void Execute_(Span<const uint8_t> data, Span<const uint8_t> arena);
+		void DrawMesh_(MeshHandle handle);
+
+		/// Vertex data is read in place, so the maps point at the meshes.
+		SlotMap<Mesh, const Mesh*> Meshes_;
+		SlotMap<Shader, const Shader*> Shaders_;
+		Owned<Software_Rasterizer> Rasterizer_;
+		Null_UniformArena UniformArena_;
+		/// Column-major, as std140 lays out a mat4.
+		float Transform_[16];
+	};
+}
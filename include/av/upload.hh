@@ -0,0 +1,73 @@
+#pragma once
+#include <av/av.hh>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace av::graphics {
+	/// Spreads mesh creation over frames. Any thread can queue vertex and
+	/// index data; the renderer works through the queue while submitting each
+	/// frame, up to a byte budget per frame, so a burst of new meshes costs a
+	/// few frames a little each instead of one frame a lot. Backends with
+	/// staging memory (the GL one's is a persistently mapped ring) copy the
+	/// data through it rather than uploading it directly.
+	class MeshUploadQueue {
+	public:
+		/// Called on the thread that submits frames (the render thread, with a
+		/// RenderThread) once the mesh can be drawn, or with a null mesh if it
+		/// couldn't be created. Takes ownership of the mesh.
+		using Callback = std::function<void(Owned<Mesh> &&mesh)>;
+
+		struct Stats {
+			size_t Pending = 0;
+			/// During the last submitted frame.
+			size_t UploadedMeshes = 0, UploadedBytes = 0;
+		};
+
+		static constexpr size_t DefaultBudget = 4 * 1024 * 1024;
+
+		/// Attaches to `renderer`, from the next frame it submits. A single
+		/// mesh bigger than the budget still goes through, in a frame of its own.
+		MeshUploadQueue(Renderer &renderer, size_t bytesPerFrame = DefaultBudget);
+		/// Detaches, waiting for a frame being submitted to be done with the
+		/// queue; meshes still queued are dropped without their callbacks.
+		/// Must not be called from one of the queue's own callbacks.
+		~MeshUploadQueue();
+
+		MeshUploadQueue(const MeshUploadQueue &) = delete;
+		MeshUploadQueue &operator=(const MeshUploadQueue &) = delete;
+
+		/// Copies the data, so it can go away right after. Safe to call from
+		/// several threads at once.
+		void Push(Span<const uint8_t> vertexData, Span<const uint8_t> indexData, const VertexSpecification &spec, Callback done);
+		void Push(Span<const uint8_t> vertexData, const VertexSpecification &spec, Callback done);
+
+		/// Takes effect from the next submitted frame.
+		void SetBudget(size_t bytesPerFrame);
+		Stats GetStats() const;
+
+	private:
+		friend class Renderer;
+
+		struct Request_ {
+			std::vector<uint8_t> VertexData, IndexData;
+			bool Indexed;
+			VertexSpecification Spec;
+			Callback Done;
+		};
+
+		void Push_(Span<const uint8_t> vertexData, Span<const uint8_t> indexData, bool indexed, const VertexSpecification &spec, Callback done);
+		/// Runs on the submitting thread, from Renderer::ProcessUploads_.
+		void Process_();
+
+		Renderer &Renderer_;
+		mutable std::mutex Mutex_;
+		/// Requests own their spec's attribute array, which doesn't survive
+		/// being moved, so the queue holds them by pointer.
+		std::deque<std::unique_ptr<Request_>> Requests_;
+		size_t Budget_, ReservedBudget_ = 0;
+		Stats Stats_;
+	};
+}
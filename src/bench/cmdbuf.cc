@@ -0,0 +1,84 @@
+// Records and replays a frame of mixed commands at growing sizes. Recording
+// time per command should stay flat as the count goes up, and lower again
+// once the buffer's allocation is reused after Reset.
+#include <av/av.hh>
+#include <av/null.hh>
+#include <fmt/core.h>
+#include <chrono>
+#include <vector>
+
+using namespace av::graphics;
+
+namespace {
+	using Clock = std::chrono::steady_clock;
+
+	double MillisecondsSince(Clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+	}
+
+	void Record(CommandBuffer &cmdBuf, size_t commandCount, const std::vector<Mesh*> &meshes, Shader *shader) {
+		static UniformId transformId = UniformId::Intern("uTransform");
+		static UniformId tintId = UniformId::Intern("uTint");
+		float transform[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1 };
+		for (size_t i = 0; i < commandCount; ++i) {
+			switch (i % 8) {
+			case 0: cmdBuf.CmdBindShader(shader); break;
+			case 1: cmdBuf.CmdUniform(tintId, 1.0f, 0.5f, 0.25f); break;
+			case 2:
+			case 5: cmdBuf.CmdUniform(transformId, transform, DataType::Float32, 4, 4); break;
+			case 7: cmdBuf.CmdClear(0.0f, 0.0f, 0.0f, 1.0f); break;
+			default: cmdBuf.CmdDrawMesh(meshes[i % meshes.size()]); break;
+			}
+		}
+		cmdBuf.End();
+	}
+}
+
+int main() {
+	Null_Renderer renderer;
+	renderer.Initialize();
+
+	VertexSpecification spec;
+	spec.Attributes.Resize(1);
+	spec.Attributes[0].Type = DataType::Float32;
+	spec.Attributes[0].Dimension = 3;
+	float vertices[9] = { 0, 0, 0, 1, 0, 0, 0, 1, 0 };
+	uint16_t indices[3] = { 0, 1, 2 };
+	std::vector<Mesh*> meshes;
+	for (int i = 0; i < 64; ++i) {
+		meshes.push_back(renderer.CreateMesh(
+			{ (uint8_t*)vertices, sizeof(vertices) },
+			{ (uint8_t*)indices, sizeof(indices) },
+			spec
+		).Release());
+	}
+	auto shader = renderer.CreateShader("", "");
+
+	fmt::print("{:>8} {:>12} {:>12} {:>12} {:>12}\n", "commands", "cold ns/cmd", "warm ns/cmd", "replay ms", "bytes");
+	for (size_t commandCount : { 12500, 25000, 50000, 100000 }) {
+		CommandBuffer cmdBuf;
+		auto start = Clock::now();
+		Record(cmdBuf, commandCount, meshes, shader.Get());
+		double cold = MillisecondsSince(start);
+
+		// Steady state: the same buffer again next frame.
+		cmdBuf.Reset();
+		start = Clock::now();
+		Record(cmdBuf, commandCount, meshes, shader.Get());
+		double warm = MillisecondsSince(start);
+
+		start = Clock::now();
+		renderer.FlushCommandBuffer(&cmdBuf);
+		double replay = MillisecondsSince(start);
+
+		fmt::print(
+			"{:>8} {:>12.1f} {:>12.1f} {:>12.3f} {:>12}\n",
+			commandCount, cold * 1e6 / commandCount, warm * 1e6 / commandCount,
+			replay, cmdBuf.GetData().GetCount()
+		);
+	}
+
+	for (auto *mesh : meshes) renderer.DestroyMesh(av::Owned<Mesh>(mesh));
+	renderer.DestroyShader(av::Owned<Shader>(shader.Release()));
+	renderer.DeInitialize();
+}
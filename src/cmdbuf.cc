@@ -1,5 +1,10 @@
 #include <av/render.hh>
+#include <cassert>
 #include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <fmt/core.h>
 
 #define DEBUG_CMD_BUF 0
@@ -7,82 +12,552 @@
 #define FMT_DEBUG(...) if (DEBUG_CMD_BUF) fmt::print(__VA_ARGS__)
 
 namespace av::graphics {
+	/// Names interned to 16-bit values, 0xFFFF being invalid. The deque keeps
+	/// returned name pointers stable.
+	class NameTable_ {
+	public:
+		explicit NameTable_(const char *kind) : Kind_(kind) {}
+
+		uint16_t Intern(const char *name) {
+			std::lock_guard lock(Mutex_);
+			auto it = Values_.find(name);
+			if (it != Values_.end()) return it->second;
+			if (Names_.size() >= 0xFFFF) {
+				fmt::print(stderr, "Too many {} names, can't intern '{}'\n", Kind_, name);
+				return 0xFFFF;
+			}
+			auto value = (uint16_t)Names_.size();
+			Names_.emplace_back(name);
+			Values_.emplace(name, value);
+			return value;
+		}
+
+		size_t GetCount() {
+			std::lock_guard lock(Mutex_);
+			return Names_.size();
+		}
+
+		const char *GetName(uint16_t value) {
+			std::lock_guard lock(Mutex_);
+			return Names_[value].c_str();
+		}
+
+	private:
+		const char *Kind_;
+		std::mutex Mutex_;
+		std::deque<std::string> Names_;
+		std::unordered_map<std::string, uint16_t> Values_;
+	};
+
+	static NameTable_ UniformNames_("uniform");
+	static NameTable_ MarkerNames_("marker");
+
+	UniformId UniformId::Intern(const char *name) {
+		return UniformId(UniformNames_.Intern(name));
+	}
+
+	size_t UniformId::GetInternedCount() {
+		return UniformNames_.GetCount();
+	}
+
+	const char *UniformId::GetName() const {
+		if (!IsValid()) return "<invalid>";
+		return UniformNames_.GetName(Value_);
+	}
+
+	MarkerId MarkerId::Intern(const char *name) {
+		return MarkerId(MarkerNames_.Intern(name));
+	}
+
+	const char *MarkerId::GetName() const {
+		if (!IsValid()) return "<invalid>";
+		return MarkerNames_.GetName(Value_);
+	}
+
+	/// Null refs record the zero handle, which never resolves.
+	template<typename T>
+	static Handle<T> HandleOf_(Ref<T> ref) {
+		return ref.Get() ? ref->GetHandle() : Handle<T>();
+	}
+
+	void CommandBuffer::PushBindShader_(ShaderHandle shader) {
+		uint8_t *p = Push_(1 + sizeof(ShaderHandle));
+		p[0] = (uint8_t)CommandType::BindShader;
+		*(ShaderHandle*)(p + 1) = shader;
+		Count_ += 1;
+	}
+
+	void CommandBuffer::PushDrawMesh_(MeshHandle mesh) {
+		uint8_t *p = Push_(1 + sizeof(MeshHandle));
+		p[0] = (uint8_t)CommandType::DrawMesh;
+		*(MeshHandle*)(p + 1) = mesh;
+		Count_ += 1;
+	}
+
 	void CommandBuffer::CmdBindShader(Ref<Shader> shader) {
-		FMT_DEBUG(stderr, "CmdBuf/BindShader {}\n", (void*)shader.Get());
-		Data_.Resize(Data_.GetCount() + 1 + sizeof(Shader*));
-		Data_[Offset_++] = (uint8_t)CommandType::BindShader;
-		*(Shader**)(Data_.GetData() + Offset_) = shader.Get();
-		Offset_ += sizeof(Shader*);
+		FMT_DEBUG(stderr, "CmdBuf/BindShader {:#x}\n", HandleOf_(shader).GetValue());
+		PushBindShader_(HandleOf_(shader));
+		ValidatedShader_ = shader.Get();
+	}
+
+	bool CommandBuffer::ValidateDraw_(const Mesh *mesh) {
+		if (!Validator_ || !ValidatedShader_ || !mesh) return true;
+		char reason[256] = "";
+		if (Validator_->CheckVertexInputs(ValidatedShader_, mesh->GetVertexSpec(), { reason, sizeof(reason) })) {
+			return true;
+		}
+		fmt::print(stderr, "Dropping draw of mesh {:#x}: {}\n", mesh->GetHandle().GetValue(), reason);
+		DroppedDraws_ += 1;
+		return false;
+	}
+
+	bool CommandBuffer::ValidatePlainDraw_(const Mesh *mesh) {
+		if (!mesh || mesh->GetVertexSpec().InstancePackedSize() == 0) return true;
+		fmt::print(stderr, "Dropping draw of mesh {:#x}: it has per-instance attributes, draw it instanced\n",
+			mesh->GetHandle().GetValue());
+		DroppedDraws_ += 1;
+		return false;
+	}
+
+	/// Slot indices are dense, so their low bits rarely collide. Collisions
+	/// only cost sorting quality, the draw itself still carries the handle.
+	template<typename T>
+	static uint64_t HandleKeyBits_(Handle<T> handle) {
+		return handle.GetIndex() & 0xFFFF;
+	}
+
+	static uint64_t MakeDrawKey_(const DrawKey &key, MeshHandle mesh) {
+		float depth = key.Depth < 0.0f ? 0.0f : key.Depth > 1.0f ? 1.0f : key.Depth;
+		return ((uint64_t)(key.Pass & 0xF) << 60)
+			| ((uint64_t)(key.Material & 0xFFF) << 32)
+			| (HandleKeyBits_(mesh) << 16)
+			| (uint64_t)(depth * 65535.0f);
+	}
+
+	void CommandBuffer::CmdDrawMesh(Ref<Mesh> mesh, const DrawKey &key) {
+		FMT_DEBUG(stderr, "CmdBuf/DrawMesh {:#x}\n", HandleOf_(mesh).GetValue());
+		if (!ValidatePlainDraw_(mesh.Get()) || !ValidateDraw_(mesh.Get())) return;
+		PushDrawMesh_(HandleOf_(mesh));
+		if (Sorted_) {
+			// Draws from before sorting was turned on get no key.
+			while (DrawKeys_.GetCount() < DrawCount_) DrawKeys_.Push(NoDrawKey_);
+			DrawKeys_.Push(MakeDrawKey_(key, HandleOf_(mesh)));
+		}
+		DrawCount_ += 1;
+	}
+
+	void CommandBuffer::CmdDrawMeshes(Span<const Ref<Mesh>> meshes) {
+		FMT_DEBUG(stderr, "CmdBuf/DrawMeshes {}\n", meshes.GetCount());
+		uint8_t *p = Push_(1 + 4 + meshes.GetCount() * sizeof(MeshHandle));
+		*p++ = (uint8_t)CommandType::DrawMeshes;
+		uint8_t *countPtr = p;
+		p += 4;
+		uint32_t count = 0;
+		for (const auto &mesh : meshes) {
+			if (!ValidatePlainDraw_(mesh.Get()) || !ValidateDraw_(mesh.Get())) continue;
+			*(MeshHandle*)p = HandleOf_(mesh);
+			p += sizeof(MeshHandle);
+			count += 1;
+		}
+		*(uint32_t*)countPtr = count;
+		Data_.Resize(Data_.GetCount() - (meshes.GetCount() - count) * sizeof(MeshHandle));
+		Count_ += 1;
+	}
+
+	void CommandBuffer::CmdDrawMeshInstanced(Ref<Mesh> mesh, Span<const uint8_t> instanceData, uint32_t instanceCount) {
+		FMT_DEBUG(stderr, "CmdBuf/DrawMeshInstanced {:#x} x{} ({} bytes)\n",
+			HandleOf_(mesh).GetValue(), instanceCount, instanceData.GetByteSize());
+		if (!ValidateDraw_(mesh.Get())) return;
+		uint64_t needed = mesh.Get() ? (uint64_t)instanceCount * mesh->GetVertexSpec().InstancePackedSize() : 0;
+		if (instanceData.GetByteSize() < needed) {
+			fmt::print(stderr, "Dropping instanced draw of mesh {:#x}: {} bytes of instance data for {} instances of {} bytes\n",
+				HandleOf_(mesh).GetValue(), instanceData.GetByteSize(), instanceCount, mesh->GetVertexSpec().InstancePackedSize());
+			DroppedDraws_ += 1;
+			return;
+		}
+		uint32_t dataSize = instanceData.GetByteSize();
+		uint8_t *p = Push_(1 + sizeof(MeshHandle) + 8 + dataSize);
+		*p++ = (uint8_t)CommandType::DrawMeshInstanced;
+		*(MeshHandle*)p = HandleOf_(mesh);
+		p += sizeof(MeshHandle);
+		*(uint32_t*)p = instanceCount;
+		*(uint32_t*)(p + 4) = dataSize;
+		CopyItems(p + 8, instanceData.GetData(), dataSize);
 		Count_ += 1;
 	}
 
-	void CommandBuffer::CmdDrawMesh(Ref<Mesh> mesh) {
-		FMT_DEBUG(stderr, "CmdBuf/DrawMesh {}\n", (void*)mesh.Get());
-		Data_.Resize(Data_.GetCount() + 1 + sizeof(Mesh*));
-		Data_[Offset_++] = (uint8_t)CommandType::DrawMesh;
-		*(Mesh**)(Data_.GetData() + Offset_) = mesh.Get();
-		Offset_ += sizeof(Mesh*);
+	void CommandBuffer::CmdExecuteBundle(Ref<Bundle> bundle) {
+		FMT_DEBUG(stderr, "CmdBuf/ExecuteBundle {}\n", (void*)bundle.Get());
+		uint8_t *p = Push_(1 + sizeof(Bundle*));
+		p[0] = (uint8_t)CommandType::ExecuteBundle;
+		*(Bundle**)(p + 1) = bundle.Get();
+		ValidatedShader_ = nullptr;
+		Count_ += 1;
+	}
+
+	void CommandBuffer::CmdBeginMarker(MarkerId id) {
+		FMT_DEBUG(stderr, "CmdBuf/BeginMarker '{}'\n", id.GetName());
+		uint8_t *p = Push_(1 + sizeof(uint16_t));
+		p[0] = (uint8_t)CommandType::BeginMarker;
+		*(uint16_t*)(p + 1) = id.GetValue();
+		Count_ += 1;
+	}
+
+	void CommandBuffer::CmdEndMarker() {
+		FMT_DEBUG(stderr, "CmdBuf/EndMarker\n");
+		*Push_(1) = (uint8_t)CommandType::EndMarker;
 		Count_ += 1;
 	}
 
 	void CommandBuffer::CmdClear(float r, float g, float b, float a) {
 		FMT_DEBUG(stderr, "CmdBuf/Clear {} {} {} {}\n", r, g, b, a);
-		Data_.Resize(Data_.GetCount() + 1 + sizeof(ClearColor));
-		Data_[Offset_++] = (uint8_t)CommandType::Clear;
-		*(ClearColor*)(Data_.GetData() + Offset_) = { r, g, b, a };
-		Offset_ += sizeof(ClearColor);
+		uint8_t *p = Push_(1 + sizeof(ClearColor));
+		p[0] = (uint8_t)CommandType::Clear;
+		*(ClearColor*)(p + 1) = { r, g, b, a };
 		Count_ += 1;
 	}
 
-	void CommandBuffer::CmdUniform(const char *name, void *value, DataType dataType, int x, int y) {
-		FMT_DEBUG(stderr, "CmdBuf/Uniform '{}' {} {} {}x{}\n", name, value,
-			DataTypeToString(dataType), x, y);
-		size_t nameSize = strlen(name) + 1;
-		size_t dataSize = VertexAttribute::GetElementSize(dataType) * x * y;
+	void CommandBuffer::CmdUniformArray(
+		UniformId id, const void *values, uint32_t count,
+		DataType dataType, int x, int y
+	) {
+		FMT_DEBUG(stderr, "CmdBuf/Uniform '{}' {} {} {}x{} [{}]\n", id.GetName(), values,
+			DataTypeToString(dataType), x, y, count);
+		uint32_t dataSize = VertexAttribute::GetElementSize(dataType) * x * y * count;
+		bool inlined = dataSize <= MaxInlineUniformSize;
 
-		Data_.Resize(Data_.GetCount() + 1 + 4 + nameSize + dataSize);
+		uint8_t *p = Push_(1 + 13 + (inlined ? dataSize : 4));
 
-		Data_[Offset_++] = (uint8_t)CommandType::Uniform; // + 1
+		*p++ = (uint8_t)CommandType::Uniform; // + 1
 		
-		Data_[Offset_++] = (uint8_t)dataType; // 1
+		*p++ = (uint8_t)dataType; // 1
 
-		Data_[Offset_++] = (x & 0xFF) | (y << 4); // 2
+		*p++ = (x & 0xFF) | (y << 4); // 2
 		
-		Data_[Offset_++] = nameSize; // 3
-		
-		CopyItems(Data_.GetData() + Offset_, (uint8_t*)name, nameSize);
-		Offset_ += nameSize; // 3 + nameSize
+		*(uint16_t*)p = id.GetValue();
+		p += sizeof(uint16_t); // 4
+
+		*(uint32_t*)p = count;
+		p += sizeof(uint32_t); // 8
+
+		*(uint32_t*)p = dataSize;
+		p += sizeof(uint32_t); // 12
 
-		Data_[Offset_++] = dataSize; // 4 + nameSize
-		CopyItems(Data_.GetData() + Offset_, (uint8_t*)value, dataSize);
+		*p++ = inlined; // 13
+		if (inlined) {
+			CopyItems(p, (const uint8_t*)values, dataSize); // 13 + dataSize
+		} else {
+			*(uint32_t*)p = Arena_.GetCount(); // 13 + 4
+			CopyItems(Arena_.Extend(dataSize), (const uint8_t*)values, dataSize);
+		}
+
+		Count_ += 1;
+	}
 
-		Offset_ += dataSize; // 4 + nameSize + dataSize
+	uint8_t *CommandBuffer::CmdUniformBlock(uint32_t binding, size_t size) {
+		FMT_DEBUG(stderr, "CmdBuf/UniformBlock {} ({} bytes)\n", binding, size);
+		uint8_t *p = Push_(1 + 13);
+		*p++ = (uint8_t)CommandType::UniformBlock;
+		*(uint32_t*)p = binding;
+		*(uint32_t*)(p + 4) = size;
 
+		UniformArena::Allocation alloc = { nullptr, 0 };
+		if (UniformArena_) alloc = UniformArena_->Allocate(size);
+		if (!alloc.Ptr) {
+			// No arena, or it's full: keep the data with the command buffer.
+			alloc = { Arena_.Extend(size), (uint32_t)(Arena_.GetCount() - size) };
+			p[8] = false;
+		} else {
+			p[8] = true;
+		}
+		*(uint32_t*)(p + 9) = alloc.Offset;
 		Count_ += 1;
+		return alloc.Ptr;
 	}
 
 	void CommandBuffer::End() {
 		FMT_DEBUG(stderr, "CmdBuf/End\n");
-		Data_.Resize(Data_.GetCount() + 1);
-		Data_[Offset_++] = (uint8_t)CommandType::End;
+		*Push_(1) = (uint8_t)CommandType::End;
 		Count_ += 1;
+		if (Sorted_) SortDraws_();
+		Ended_ = true;
+	}
+
+	void CommandBuffer::Reopen_() {
+		Data_.Resize(Data_.GetCount() - 1);
+		Count_ -= 1;
+		Ended_ = false;
+	}
+
+	/// Stable LSD radix sort on the key, one byte per pass. Passes where every
+	/// key has the same byte are skipped. Sorts into `items`, using `scratch`.
+	template<typename T>
+	static void RadixSort_(GrowingSpan<T> &items, GrowingSpan<T> &scratch) {
+		size_t count = items.GetCount();
+		if (count < 2) return;
+		scratch.Resize(count);
+		auto *src = items.GetData(), *dst = scratch.GetData();
+		for (int shift = 0; shift < 64; shift += 8) {
+			size_t offsets[256] = {};
+			for (size_t i = 0; i < count; ++i) {
+				offsets[(src[i].Key >> shift) & 0xFF] += 1;
+			}
+			if (offsets[(src[0].Key >> shift) & 0xFF] == count) continue;
+			size_t total = 0;
+			for (auto &offset : offsets) {
+				size_t n = offset;
+				offset = total;
+				total += n;
+			}
+			for (size_t i = 0; i < count; ++i) {
+				dst[offsets[(src[i].Key >> shift) & 0xFF]++] = src[i];
+			}
+			auto *tmp = src; src = dst; dst = tmp;
+		}
+		if (src != items.GetData()) CopyItems(items.GetData(), src, count);
+	}
+
+	void CommandBuffer::EmitSortedDraws_(ShaderHandle &emittedShader) {
+		RadixSort_(SortItems_, SortScratch_);
+		for (const auto &item : SortItems_) {
+			if (item.BoundShader != emittedShader) {
+				PushBindShader_(item.BoundShader);
+				emittedShader = item.BoundShader;
+			}
+			PushDrawMesh_(item.DrawnMesh);
+		}
+		SortItems_.Clear();
+	}
+
+	void CommandBuffer::SortDraws_() {
+		// Re-record the stream in sorted order into Data_, reading the original
+		// from Unsorted_. Both keep their allocations, so this doesn't allocate
+		// once the buffers have grown to the frame's size.
+		Data_.Swap(Unsorted_);
+		Data_.Clear();
+		Count_ = 0;
+		Sorted_ = false;
+
+		CommandBufferReader reader(Unsorted_, Arena_);
+		ShaderHandle recordedShader, emittedShader;
+		size_t drawIndex = 0;
+		while (true) {
+			size_t start = reader.GetOffset();
+			auto type = reader.ReadType();
+
+			if (type == CommandType::BindShader) {
+				recordedShader = reader.ReadCmdBindShader();
+				continue;
+			}
+
+			if (type == CommandType::DrawMesh) {
+				MeshHandle mesh = reader.ReadCmdDrawMesh();
+				// Keys never have every bit set, as the shader bits are still clear.
+				uint64_t key = drawIndex < DrawKeys_.GetCount() ? DrawKeys_[drawIndex] : NoDrawKey_;
+				drawIndex += 1;
+				if (recordedShader.IsValid() && key != NoDrawKey_) {
+					key |= HandleKeyBits_(recordedShader) << 44;
+					SortItems_.Push({ key, mesh, recordedShader });
+					continue;
+				}
+			} else {
+				reader.SkipCmd(type);
+			}
+
+			// Barrier: everything before it goes out sorted, then the command
+			// itself, with the shader it was recorded under.
+			EmitSortedDraws_(emittedShader);
+			if (recordedShader != emittedShader) {
+				PushBindShader_(recordedShader);
+				emittedShader = recordedShader;
+			}
+			size_t size = reader.GetOffset() - start;
+			CopyItems(Push_(size), Unsorted_.GetData() + start, size);
+			Count_ += 1;
+
+			if (type == CommandType::End) break;
+		}
+
+		Sorted_ = true;
+		// Draws recorded after reopening don't move past these.
+		DrawKeys_.Clear();
+		DrawCount_ = drawIndex;
+	}
+
+	Span<CommandBuffer> Renderer::BeginWorkerCommandBuffers(size_t count) {
+		auto &frame = Frames_[GetFrameSlot()];
+		assert(count <= MaxWorkerCommandBuffers);
+		if (count > MaxWorkerCommandBuffers) {
+			fmt::print(stderr, "Asked for {} worker command buffers, handing out {}\n", count, MaxWorkerCommandBuffers);
+			count = MaxWorkerCommandBuffers;
+		}
+		for (size_t i = 0; i < count; ++i) {
+			frame.Workers[i].Reset();
+			frame.Workers[i].SetUniformArena(frame.Arena);
+			frame.Workers[i].SetValidator(RecordValidation_ ? this : nullptr);
+		}
+		frame.WorkerCount = count;
+		return { frame.Workers, count };
+	}
+
+	void Renderer::EndUnterminated_(Span<Ref<CommandBuffer>> cmdBufs, uint64_t frameIndex) {
+		// Backends read up to the End command, so a buffer without one
+		// would be read past its end.
+		for (size_t i = 0; i < cmdBufs.GetCount(); ++i) {
+			if (cmdBufs[i]->GetCount() == 0 || cmdBufs[i]->IsEnded()) continue;
+			fmt::print(stderr, "Command buffer {} of frame {} wasn't ended\n", i, frameIndex);
+			cmdBufs[i]->End();
+		}
+	}
+
+	/// Checks that the payload of the command of `type` starting at `offset`
+	/// fits in `data`, that what it points to in `arena` does too, and that it
+	/// doesn't reference a null object. Sets `size` to the payload's size.
+	static bool CheckBundleCommand_(
+		Span<const uint8_t> data, Span<const uint8_t> arena,
+		size_t offset, CommandType type, size_t &size
+	) {
+		const uint8_t *p = data.GetData() + offset;
+		size_t remaining = data.GetCount() - offset;
+		auto read32 = [](const uint8_t *at) { return *(const uint32_t*)at; };
+		auto inArena = [&](uint64_t start, uint64_t bytes) { return start + bytes <= arena.GetCount(); };
+		switch (type) {
+		case CommandType::DrawMesh:
+			size = sizeof(MeshHandle);
+			return remaining >= size && ((const MeshHandle*)p)->IsValid();
+		case CommandType::DrawMeshInstanced:
+			size = sizeof(MeshHandle) + 8;
+			if (remaining < size) return false;
+			size += read32(p + sizeof(MeshHandle) + 4);
+			return remaining >= size && ((const MeshHandle*)p)->IsValid();
+		case CommandType::DrawMeshes: {
+			if (remaining < 4) return false;
+			uint64_t count = read32(p);
+			if (count > (remaining - 4) / sizeof(MeshHandle)) return false;
+			size = 4 + count * sizeof(MeshHandle);
+			for (uint64_t i = 0; i < count; ++i) {
+				if (!((const MeshHandle*)(p + 4))[i].IsValid()) return false;
+			}
+			return true;
+		}
+		case CommandType::BindShader:
+			size = sizeof(ShaderHandle);
+			return remaining >= size && ((const ShaderHandle*)p)->IsValid();
+		case CommandType::ExecuteBundle:
+			size = sizeof(Bundle*);
+			return remaining >= size && *(Bundle* const*)p;
+		case CommandType::Uniform: {
+			// Type, size, id, count, data size and whether it's inline.
+			size = 1 + 1 + 2 + 4 + 4 + 1;
+			if (remaining < size) return false;
+			uint32_t dataSize = read32(p + 8);
+			if (p[12]) {
+				size += dataSize;
+				return remaining >= size;
+			}
+			size += 4;
+			return remaining >= size && inArena(read32(p + 13), dataSize);
+		}
+		case CommandType::UniformBlock:
+			// Binding, size, whether it's in the uniform arena and where.
+			size = 4 + 4 + 1 + 4;
+			if (remaining < size) return false;
+			// The uniform arena is recycled every frame, so bundles can't point into it.
+			return !p[8] && inArena(read32(p + 9), read32(p + 4));
+		case CommandType::Clear:
+			size = sizeof(ClearColor);
+			return remaining >= size;
+		case CommandType::BeginMarker:
+			size = sizeof(uint16_t);
+			return remaining >= size;
+		case CommandType::EndMarker:
+		case CommandType::End:
+			size = 0;
+			return true;
+		}
+		return false;
+	}
+
+	bool ValidateBundleData(Span<const uint8_t> data, Span<const uint8_t> arena) {
+		size_t offset = 0;
+		while (true) {
+			if (offset >= data.GetCount()) {
+				fmt::print(stderr, "Bundle command buffer wasn't ended\n");
+				return false;
+			}
+			auto type = (CommandType)data[offset++];
+			if (type == CommandType::End) return true;
+
+			size_t size;
+			if (!CheckBundleCommand_(data, arena, offset, type, size)) {
+				fmt::print(stderr, "Invalid command {:#x} in bundle command buffer\n", (int)type);
+				return false;
+			}
+			offset += size;
+		}
 	}
 
 	CommandType CommandBufferReader::ReadType() {
 		return (CommandType)Data_[Offset_++];
 	}
 
-	Mesh *CommandBufferReader::ReadCmdDrawMesh() {
-		auto *v = *(Mesh**)(Data_.GetData() + Offset_);
-		Offset_ += sizeof(uint64_t);
-		FMT_DEBUG(stderr, "CmdBufReader/DrawMesh {}\n", (void*)v);
+	void CommandBufferReader::SkipCmd(CommandType type) {
+		switch (type) {
+			case CommandType::DrawMesh: ReadCmdDrawMesh(); break;
+			case CommandType::DrawMeshInstanced: ReadCmdDrawMeshInstanced(); break;
+			case CommandType::DrawMeshes: ReadCmdDrawMeshes(); break;
+			case CommandType::BindShader: ReadCmdBindShader(); break;
+			case CommandType::ExecuteBundle: ReadCmdExecuteBundle(); break;
+			case CommandType::Uniform: ReadCmdUniform(); break;
+			case CommandType::UniformBlock: ReadCmdUniformBlock(); break;
+			case CommandType::Clear: ReadCmdClear(); break;
+			case CommandType::BeginMarker: ReadCmdBeginMarker(); break;
+			case CommandType::EndMarker: ReadCmdEndMarker(); break;
+			case CommandType::End: break;
+		}
+	}
+
+	MeshHandle CommandBufferReader::ReadCmdDrawMesh() {
+		auto v = *(const MeshHandle*)(Data_.GetData() + Offset_);
+		Offset_ += sizeof(MeshHandle);
+		FMT_DEBUG(stderr, "CmdBufReader/DrawMesh {:#x}\n", v.GetValue());
 		return v;
 	}
 
-	Shader *CommandBufferReader::ReadCmdBindShader() {
-		auto *v = *(Shader**)(Data_.GetData() + Offset_);
-		Offset_ += sizeof(uint64_t);
-		FMT_DEBUG(stderr, "CmdBufReader/BindShader {}\n", (void*)v);
+	InstancedDrawData CommandBufferReader::ReadCmdDrawMeshInstanced() {
+		InstancedDrawData data;
+		data.DrawnMesh = *(const MeshHandle*)(Data_.GetData() + Offset_);
+		Offset_ += sizeof(MeshHandle);
+		data.InstanceCount = *(const uint32_t*)(Data_.GetData() + Offset_);
+		uint32_t dataSize = *(const uint32_t*)(Data_.GetData() + Offset_ + 4);
+		Offset_ += 8;
+		data.InstanceData = { Data_.GetData() + Offset_, dataSize };
+		Offset_ += dataSize;
+		FMT_DEBUG(stderr, "CmdBufReader/DrawMeshInstanced {:#x} x{} ({} bytes)\n",
+			data.DrawnMesh.GetValue(), data.InstanceCount, dataSize);
+		return data;
+	}
+
+	Span<const MeshHandle> CommandBufferReader::ReadCmdDrawMeshes() {
+		uint32_t count = *(const uint32_t*)(Data_.GetData() + Offset_);
+		Offset_ += 4;
+		Span<const MeshHandle> meshes = { (const MeshHandle*)(Data_.GetData() + Offset_), count };
+		Offset_ += count * sizeof(MeshHandle);
+		FMT_DEBUG(stderr, "CmdBufReader/DrawMeshes {}\n", count);
+		return meshes;
+	}
+
+	ShaderHandle CommandBufferReader::ReadCmdBindShader() {
+		auto v = *(const ShaderHandle*)(Data_.GetData() + Offset_);
+		Offset_ += sizeof(ShaderHandle);
+		FMT_DEBUG(stderr, "CmdBufReader/BindShader {:#x}\n", v.GetValue());
+		return v;
+	}
+
+	Bundle *CommandBufferReader::ReadCmdExecuteBundle() {
+		auto *v = *(Bundle**)(Data_.GetData() + Offset_);
+		Offset_ += sizeof(Bundle*);
+		FMT_DEBUG(stderr, "CmdBufReader/ExecuteBundle {}\n", (void*)v);
 		return v;
 	}
 
@@ -92,15 +567,37 @@ namespace av::graphics {
 		data.SizeX = Data_[Offset_] & 0xFF;
 		data.SizeY = Data_[Offset_] >> 4;
 		Offset_ += 1;
-		size_t nameSize = Data_[Offset_++];
-		data.Name = (const char *)Data_.GetData() + Offset_;
-		Offset_ += nameSize;
-		size_t dataSize = Data_[Offset_++];
-		data.Data = { Data_.GetData() + Offset_, dataSize };
-		Offset_ += dataSize;
-		FMT_DEBUG(stderr, "CmdBufReader/Uniform '{}' {} {} {}x{}\n",
-			data.Name, (void*)data.Data.GetData(), DataTypeToString(data.Type),
-			(int)data.SizeX, (int)data.SizeY);
+		data.Id = UniformId(*(const uint16_t*)(Data_.GetData() + Offset_));
+		Offset_ += sizeof(uint16_t);
+		data.Count = *(const uint32_t*)(Data_.GetData() + Offset_);
+		Offset_ += sizeof(uint32_t);
+		size_t dataSize = *(const uint32_t*)(Data_.GetData() + Offset_);
+		Offset_ += sizeof(uint32_t);
+		bool inlined = Data_[Offset_++];
+		if (inlined) {
+			data.Data = { Data_.GetData() + Offset_, dataSize };
+			Offset_ += dataSize;
+		} else {
+			size_t arenaOffset = *(const uint32_t*)(Data_.GetData() + Offset_);
+			data.Data = { Arena_.GetData() + arenaOffset, dataSize };
+			Offset_ += sizeof(uint32_t);
+		}
+		FMT_DEBUG(stderr, "CmdBufReader/Uniform '{}' {} {} {}x{} [{}]\n",
+			data.Id.GetName(), (void*)data.Data.GetData(), DataTypeToString(data.Type),
+			(int)data.SizeX, (int)data.SizeY, data.Count);
+		return data;
+	}
+
+	UniformBlockData CommandBufferReader::ReadCmdUniformBlock() {
+		UniformBlockData data;
+		data.Binding = *(const uint32_t*)(Data_.GetData() + Offset_);
+		data.Size = *(const uint32_t*)(Data_.GetData() + Offset_ + 4);
+		data.InUniformArena = Data_[Offset_ + 8];
+		data.ArenaOffset = *(const uint32_t*)(Data_.GetData() + Offset_ + 9);
+		Offset_ += 13;
+		if (!data.InUniformArena) data.Data = { Arena_.GetData() + data.ArenaOffset, data.Size };
+		FMT_DEBUG(stderr, "CmdBufReader/UniformBlock {} ({} bytes{})\n",
+			data.Binding, data.Size, data.InUniformArena ? ", in uniform arena" : "");
 		return data;
 	}
 
@@ -110,4 +607,11 @@ namespace av::graphics {
 		FMT_DEBUG(stderr, "CmdBufReader/Clear {} {} {} {}\n", v->r, v->g, v->b, v->a);
 		return *v;
 	}
+
+	MarkerId CommandBufferReader::ReadCmdBeginMarker() {
+		auto v = *(uint16_t*)(Data_.GetData() + Offset_);
+		Offset_ += sizeof(uint16_t);
+		FMT_DEBUG(stderr, "CmdBufReader/BeginMarker {}\n", v);
+		return MarkerId(v);
+	}
 }
@@ -1,5 +1,9 @@
 #include <av/av.hh>
+#include <av/meshopt.hh>
+#include <av/null.hh>
 #include <av/opengl.hh>
+#include <av/renderthread.hh>
+#include <av/software.hh>
 #include <GL/gl3w.h>
 #include <GLFW/glfw3.h>
 #include <fmt/core.h>
@@ -7,6 +11,8 @@
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <tiny_obj_loader.hh>
+#include <chrono>
+#include <cstring>
 
 /// Adds a nul at the end.
 av::OwningSpan<char> ReadFile(const char *filename) {
@@ -92,19 +98,37 @@ av::Owned<av::graphics::Mesh> CreateMeshFromObjFile(av::graphics::Renderer *rend
 		glm::vec2 tex;
 	};
 
+	// What gets uploaded: half the size of Vertex. Positions are padded to
+	// four halves to keep the normal word aligned; w reads as 1 either way.
+	struct PackedVertex {
+		uint16_t pos[4];
+		uint32_t norm;
+		uint16_t tex[2];
+	};
+	auto pack = [](const Vertex &v) {
+		using av::graphics::FloatToHalf;
+		return PackedVertex {
+			{ FloatToHalf(v.pos.x), FloatToHalf(v.pos.y), FloatToHalf(v.pos.z), FloatToHalf(1.0f) },
+			av::graphics::PackSnorm_2_10_10_10_Rev(v.norm.x, v.norm.y, v.norm.z, 0.0f),
+			{ FloatToHalf(v.tex.x), FloatToHalf(v.tex.y) }
+		};
+	};
+
 	av::graphics::VertexSpecification vertexSpec;
-	vertexSpec.IndexType = av::graphics::DataType::Int16;
+	// Replaced by whatever CreateOptimizedMesh picks for the welded mesh.
+	vertexSpec.IndexType = av::graphics::DataType::UInt16;
 	vertexSpec.Attributes.Resize(3);
-	vertexSpec.Attributes[0].Type = av::graphics::DataType::Float32;
-	vertexSpec.Attributes[0].Dimension = 3;
-	vertexSpec.Attributes[1].Type = av::graphics::DataType::Float32;
-	vertexSpec.Attributes[1].Dimension = 3;
-	vertexSpec.Attributes[2].Type = av::graphics::DataType::Float32;
+	vertexSpec.Attributes[0].Type = av::graphics::DataType::Half16;
+	vertexSpec.Attributes[0].Dimension = 4;
+	vertexSpec.Attributes[1].Type = av::graphics::DataType::Int_2_10_10_10_Rev;
+	vertexSpec.Attributes[1].Dimension = 4;
+	vertexSpec.Attributes[1].Normalized = true;
+	vertexSpec.Attributes[2].Type = av::graphics::DataType::Half16;
 	vertexSpec.Attributes[2].Dimension = 2;
 
 	size_t totalVertexCount = 0;
 	for (size_t s = 0; s < shapes.size(); ++s) {
-		totalVertexCount = shapes[s].mesh.num_face_vertices.size() * 3;
+		totalVertexCount += shapes[s].mesh.num_face_vertices.size() * 3;
 	}
 
 	av::OwningSpan<Vertex> vertices(totalVertexCount);
@@ -133,17 +157,18 @@ av::Owned<av::graphics::Mesh> CreateMeshFromObjFile(av::graphics::Renderer *rend
 		}
 	}
 
-	Vertex vertices2[6] = {
-		{ { -1.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 0.0f } },
-		{ { +1.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 0.0f } },
-		{ { -1.0f, +1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f } },
-
-		{ { +1.0f, -1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 0.0f } },
-		{ { -1.0f, +1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 0.0f, 1.0f } },
-		{ { +1.0f, +1.0f, 0.0f }, { 0.0f, 0.0f, 1.0f }, { 1.0f, 1.0f } },
-	};
-
-	return renderer->CreateMesh({ (uint8_t*)vertices2, sizeof(vertices2) }, vertexSpec);
+	// Faces come out of the obj as triangle soup; welding the packed
+	// vertices turns it back into an indexed mesh.
+	av::OwningSpan<PackedVertex> packed(totalVertexCount);
+	for (size_t i = 0; i < totalVertexCount; ++i) packed[i] = pack(vertices[i]);
+
+	av::graphics::MeshOptimizeStats stats;
+	auto mesh = av::graphics::CreateOptimizedMesh(
+		*renderer, { (const uint8_t*)packed.GetData(), packed.GetByteSize() }, {}, vertexSpec, {}, &stats
+	);
+	fmt::print("{}: {} -> {} vertices, {} triangles, ACMR {:.3f} -> {:.3f}\n", fname,
+		stats.InputVertexCount, stats.OutputVertexCount, stats.TriangleCount, stats.AcmrBefore, stats.AcmrAfter);
+	return av::Owned<av::graphics::Mesh>(mesh.Release());
 }
 
 class Transform {
@@ -216,7 +241,119 @@ private:
 };
 
 
-int main() {
+/// Records the frame seen from `cam`; shared by the windowed and headless loops.
+void RecordFrame(
+	av::Ref<av::graphics::CommandBuffer> buffer,
+	Camera &cam,
+	av::Ref<av::graphics::Shader> shader,
+	av::Ref<av::graphics::Mesh> mesh
+) {
+	static const auto frameMarker = av::graphics::MarkerId::Intern("frame");
+	static const auto sceneMarker = av::graphics::MarkerId::Intern("scene");
+
+	auto mat = cam.ComputeMatrix();
+
+	{
+		av::graphics::ScopedMarker frameScope(buffer, frameMarker);
+		buffer->CmdClear(0.2f, 0.1, 0.3f, 1.0f);
+		av::graphics::ScopedMarker sceneScope(buffer, sceneMarker);
+		buffer->CmdBindShader(shader);
+		buffer->CmdUniformBlock(0, glm::value_ptr(mat), sizeof(mat));
+		buffer->CmdDrawMesh(mesh);
+	}
+	buffer->End();
+}
+
+/// Scripted camera path for headless runs: a slow orbit around the origin that
+/// bobs up and down, so every run records the same frames.
+void MoveCameraAlongPath(Camera &cam, size_t frame) {
+	float t = frame / 60.0f;
+	float angle = t * 0.5f;
+	glm::vec3 position { 5.0f * glm::sin(angle), 1.0f + 0.5f * glm::sin(t), 5.0f * glm::cos(angle) };
+	cam.GetTransform().Position(position);
+	cam.GetTransform().Rotation(glm::quatLookAt(glm::normalize(-position), { 0.f, 1.f, 0.f }));
+}
+
+int RunHeadless(size_t frameCount) {
+	using Clock = std::chrono::steady_clock;
+
+	av::graphics::Null_Renderer renderer;
+
+	renderer.Initialize();
+
+	auto mesh = CreateMeshFromObjFile(&renderer, "./data/meshes/cube.obj");
+	auto shader = CreateShaderFromFiles(&renderer, "./data/shaders/main.vert", "./data/shaders/main.frag");
+
+	Camera cam(90.0f, 640 / 480.0f, 0.01f, 100.0f);
+
+	Clock::duration recordTime {}, flushTime {};
+	for (size_t frame = 0; frame < frameCount; ++frame) {
+		MoveCameraAlongPath(cam, frame);
+
+		auto start = Clock::now();
+		auto buffer = renderer.BeginFrame();
+		RecordFrame(buffer, cam, shader, mesh);
+		auto recorded = Clock::now();
+		renderer.EndFrame();
+		auto flushed = Clock::now();
+
+		recordTime += recorded - start;
+		flushTime += flushed - recorded;
+	}
+
+	auto micros = [&](Clock::duration d) {
+		return std::chrono::duration<double, std::micro>(d).count() / (frameCount ? frameCount : 1);
+	};
+	const auto &stats = renderer.GetTotalStats();
+	fmt::print("{} frames, record {:.2f}us/frame, flush {:.2f}us/frame\n", frameCount, micros(recordTime), micros(flushTime));
+	fmt::print("  commands {}, draws {} in {} calls, instances {}, triangles {}\n",
+		stats.Commands, stats.Draws, stats.DrawCalls, stats.Instances, stats.Triangles);
+	fmt::print("  shader binds {} ({} changes), mesh changes {}, clears {}, bundles {}\n",
+		stats.ShaderBinds, stats.ShaderChanges, stats.MeshChanges, stats.Clears, stats.BundlesExecuted);
+	fmt::print("  uniforms {} ({} bytes), uniform blocks {} ({} bytes)\n",
+		stats.Uniforms, stats.UniformBytes, stats.UniformBlocks, stats.UniformBlockBytes);
+	fmt::print("  stream {} bytes, side arena {} bytes\n", stats.StreamBytes, stats.ArenaBytes);
+
+	renderer.DestroyShader(std::move(shader));
+	renderer.DestroyMesh(std::move(mesh));
+	renderer.DeInitialize();
+	return 0;
+}
+
+/// Renders the scripted path on the CPU and writes the last frame to `output`.
+int RunSoftware(size_t frameCount, const char *output) {
+	using Clock = std::chrono::steady_clock;
+
+	av::graphics::Software_Renderer renderer(640, 480);
+
+	renderer.Initialize();
+
+	auto mesh = CreateMeshFromObjFile(&renderer, "./data/meshes/cube.obj");
+	auto shader = CreateShaderFromFiles(&renderer, "./data/shaders/main.vert", "./data/shaders/main.frag");
+
+	Camera cam(90.0f, 640 / 480.0f, 0.01f, 100.0f);
+
+	auto start = Clock::now();
+	for (size_t frame = 0; frame < frameCount; ++frame) {
+		MoveCameraAlongPath(cam, frame);
+		RecordFrame(renderer.BeginFrame(), cam, shader, mesh);
+		renderer.EndFrame();
+	}
+	auto elapsed = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+
+	fmt::print("{} frames, {:.3f}ms/frame ({})\n",
+		frameCount, elapsed / (frameCount ? frameCount : 1), renderer.IsUsingSIMD() ? "AVX2" : "scalar");
+	bool written = renderer.GetFramebuffer().WritePPM(output);
+
+	renderer.DestroyShader(std::move(shader));
+	renderer.DestroyMesh(std::move(mesh));
+	renderer.DeInitialize();
+	return written ? 0 : 1;
+}
+
+/// Opens a window and renders with OpenGL. With `profileOutput`, GPU marker
+/// timings are written there on exit.
+int RunWindowed(const char *profileOutput) {
 	glfwSetErrorCallback([](int error, const char *message) {
 		fmt::print(stderr, "GLFW error: {} {}\n", error, message);
 	});
@@ -255,14 +392,28 @@ int main() {
 	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
 
 	av::graphics::OpenGL_Renderer renderer;
-
-	renderer.Initialize();
+	renderer.SetProgramCacheDirectory("./cache");
+	renderer.GetGpuProfiler().SetEnabled(profileOutput != nullptr);
 
 	int width, height;
 	glfwGetFramebufferSize(window, &width, &height);
 
-	auto mesh = CreateMeshFromObjFile(&renderer, "./data/meshes/cube.obj");
-	auto shader = CreateShaderFromFiles(&renderer, "./data/shaders/main.vert", "./data/shaders/main.frag");
+	// From here on the context belongs to the render thread.
+	glfwMakeContextCurrent(nullptr);
+	av::graphics::RenderThread renderThread(renderer,
+		[&] { glfwMakeContextCurrent(window); renderer.Initialize(); },
+		[&] { glfwSwapBuffers(window); },
+		[&] { renderer.DeInitialize(); glfwMakeContextCurrent(nullptr); }
+	);
+
+	av::graphics::Mesh *meshPtr = nullptr;
+	av::graphics::Shader *shaderPtr = nullptr;
+	renderThread.Invoke([&] {
+		meshPtr = CreateMeshFromObjFile(&renderer, "./data/meshes/cube.obj").Release();
+		shaderPtr = CreateShaderFromFiles(&renderer, "./data/shaders/main.vert", "./data/shaders/main.frag").Release();
+	});
+	av::Owned<av::graphics::Mesh> mesh = meshPtr;
+	av::Owned<av::graphics::Shader> shader = shaderPtr;
 
 	Camera cam(90.0f, width /(float) height, 0.01f, 100.0f);
 	cam.GetTransform().Position({ 0, 1.0f, 5.0f });
@@ -271,26 +422,55 @@ int main() {
 		{ 0.f, 1.f, 0.f }
 	));
 
+	auto status = av::graphics::ShaderStatus::Compiling;
 	while (!glfwWindowShouldClose(window)) {
 		glfwPollEvents();
 
-		auto mat = cam.ComputeMatrix();
+		// Asking waits on the render thread, so stop once the shader is ready.
+		// The build log has already been printed.
+		if (status == av::graphics::ShaderStatus::Compiling) status = renderThread.GetShaderStatus(shader);
+		if (status == av::graphics::ShaderStatus::Failed) break;
 
-		av::graphics::CommandBuffer buffer;
-		buffer.CmdClear(0.2f, 0.1, 0.3f, 1.0f);
-		buffer.CmdBindShader(shader);
-		buffer.CmdUniform("uTransform", glm::value_ptr(mat), av::graphics::DataType::Float32, 4, 4);
-		buffer.CmdDrawMesh(mesh);
-		buffer.End();
-		renderer.FlushCommandBuffer(&buffer);
-
-		glfwSwapBuffers(window);
+		RecordFrame(renderThread.BeginFrame(), cam, shader, mesh);
+		renderThread.EndFrame();
 	}
 
-	renderer.DestroyShader(std::move(shader));
-	renderer.DestroyMesh(std::move(mesh));
-	renderer.DeInitialize();
+	renderThread.DestroyShader(std::move(shader));
+	renderThread.DestroyMesh(std::move(mesh));
+	renderThread.Stop();
+
+	if (profileOutput) renderer.GetGpuProfiler().WriteCSV(profileOutput);
+
+	const auto &cacheStats = renderer.GetProgramCacheStats();
+	fmt::print("program cache: {} hits, {} misses ({} rejected), load {:.1f}ms, compile {:.1f}ms, saved {:.1f}ms\n",
+		cacheStats.Hits, cacheStats.Misses, cacheStats.Rejected,
+		cacheStats.LoadMs, cacheStats.CompileMs, cacheStats.SavedMs);
 
 	glfwDestroyWindow(window);
 	glfwTerminate();
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	bool headless = false;
+	const char *softwareOutput = nullptr;
+	const char *profileOutput = nullptr;
+	size_t frameCount = 1000;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--headless") == 0) {
+			headless = true;
+		} else if (strcmp(argv[i], "--software") == 0 && i + 1 < argc) {
+			softwareOutput = argv[++i];
+		} else if (strcmp(argv[i], "--gpu-profile") == 0 && i + 1 < argc) {
+			profileOutput = argv[++i];
+		} else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+			frameCount = strtoull(argv[++i], nullptr, 10);
+		} else {
+			fmt::print(stderr, "Usage: {} [--headless | --software OUT.ppm | --gpu-profile OUT.csv] [--frames N]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (softwareOutput) return RunSoftware(frameCount, softwareOutput);
+	return headless ? RunHeadless(frameCount) : RunWindowed(profileOutput);
 }
@@ -0,0 +1,415 @@
+#include <av/meshopt.hh>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+namespace av::graphics {
+	static size_t ReadIndex_(const uint8_t *indices, size_t indexSize, size_t i) {
+		switch (indexSize) {
+		case 1: return indices[i];
+		case 2: { uint16_t v; CopyItems((uint8_t*)&v, indices + i * 2, 2); return v; }
+		default: { uint32_t v; CopyItems((uint8_t*)&v, indices + i * 4, 4); return v; }
+		}
+	}
+
+	float ComputeAcmr(Span<const uint32_t> indices, size_t vertexCount, size_t cacheSize) {
+		size_t triangleCount = indices.GetCount() / 3;
+		if (triangleCount == 0) return 0.0f;
+		// A vertex is cached while fewer than cacheSize misses happened since
+		// its own; timestamps start far enough ahead that nothing is cached.
+		std::vector<size_t> loadedAt(vertexCount, 0);
+		size_t time = cacheSize + 1, misses = 0;
+		for (size_t i = 0; i < triangleCount * 3; ++i) {
+			uint32_t v = indices[i];
+			if (v >= vertexCount) continue;
+			if (time - loadedAt[v] > cacheSize) {
+				loadedAt[v] = time++;
+				misses += 1;
+			}
+		}
+		return (float)misses / (float)triangleCount;
+	}
+
+	/// Merges byte-identical vertices. Fills `remap` with the welded index
+	/// of every input vertex and returns how many are left.
+	static size_t WeldVertices_(const uint8_t *vertices, size_t vertexCount, size_t stride, std::vector<uint32_t> &remap) {
+		size_t tableSize = 16;
+		while (tableSize < vertexCount * 2) tableSize *= 2;
+		std::vector<uint32_t> table(tableSize, 0xFFFFFFFF);
+		remap.resize(vertexCount);
+
+		size_t unique = 0;
+		for (size_t v = 0; v < vertexCount; ++v) {
+			const uint8_t *bytes = vertices + v * stride;
+			uint64_t hash = 0xcbf29ce484222325;
+			for (size_t i = 0; i < stride; ++i) {
+				hash ^= bytes[i];
+				hash *= 0x100000001b3;
+			}
+			// Linear probing; the table stores the first input vertex of each group.
+			for (size_t slot = hash & (tableSize - 1);; slot = (slot + 1) & (tableSize - 1)) {
+				if (table[slot] == 0xFFFFFFFF) {
+					table[slot] = v;
+					remap[v] = unique++;
+					break;
+				}
+				if (memcmp(vertices + table[slot] * stride, bytes, stride) == 0) {
+					remap[v] = remap[table[slot]];
+					break;
+				}
+			}
+		}
+		return unique;
+	}
+
+	/// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation": greedily emits
+	/// the triangle whose vertices score best, by how recently they were used
+	/// in a modelled LRU cache and how few triangles still need them.
+	static void OptimizeVertexCache_(std::vector<uint32_t> &indices, size_t vertexCount) {
+		constexpr size_t cacheSize = 32;
+		constexpr size_t maxValence = 32;
+		static const struct Tables_ {
+			float Cache[cacheSize], Valence[maxValence + 1];
+			Tables_() {
+				for (size_t i = 0; i < cacheSize; ++i) {
+					// The last triangle's three vertices are scored alike, so
+					// the next one doesn't favour any particular edge.
+					Cache[i] = i < 3 ? 0.75f : std::pow(1.0f - (float)(i - 3) / (float)(cacheSize - 3), 1.5f);
+				}
+				Valence[0] = 0.0f;
+				for (size_t i = 1; i <= maxValence; ++i) Valence[i] = 2.0f / std::sqrt((float)i);
+			}
+		} tables;
+
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount == 0) return;
+
+		// Triangles of each vertex, with the ones not yet emitted first.
+		std::vector<uint32_t> offsets(vertexCount + 1, 0), live(vertexCount, 0);
+		for (uint32_t v : indices) live[v] += 1;
+		for (size_t v = 0; v < vertexCount; ++v) offsets[v + 1] = offsets[v] + live[v];
+		std::vector<uint32_t> adjacency(indices.size()), fill(offsets.begin(), offsets.end() - 1);
+		for (size_t t = 0; t < triangleCount; ++t) {
+			for (size_t k = 0; k < 3; ++k) adjacency[fill[indices[t * 3 + k]]++] = t;
+		}
+
+		std::vector<int32_t> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount), triangleScore(triangleCount, 0.0f);
+		std::vector<bool> emitted(triangleCount, false);
+		auto score = [&](uint32_t v) {
+			if (live[v] == 0) return -1.0f;
+			int32_t position = cachePosition[v];
+			return (position >= 0 ? tables.Cache[position] : 0.0f) + tables.Valence[std::min<size_t>(live[v], maxValence)];
+		};
+		for (size_t v = 0; v < vertexCount; ++v) vertexScore[v] = score(v);
+		size_t best = 0;
+		for (size_t t = 0; t < triangleCount; ++t) {
+			for (size_t k = 0; k < 3; ++k) triangleScore[t] += vertexScore[indices[t * 3 + k]];
+			if (triangleScore[t] > triangleScore[best]) best = t;
+		}
+
+		std::vector<uint32_t> output;
+		output.reserve(indices.size());
+		uint32_t cache[cacheSize + 3], nextCache[cacheSize + 3];
+		size_t cacheCount = 0, scan = 0;
+		for (size_t emittedCount = 0; emittedCount < triangleCount; ++emittedCount) {
+			if (best == (size_t)-1) {
+				// Nothing in the cache has live triangles left; start on the
+				// next one in input order.
+				while (emitted[scan]) ++scan;
+				best = scan;
+			}
+			const uint32_t *triangle = &indices[best * 3];
+			emitted[best] = true;
+			output.insert(output.end(), triangle, triangle + 3);
+
+			size_t nextCount = 0;
+			for (size_t k = 0; k < 3; ++k) {
+				uint32_t v = triangle[k];
+				uint32_t *begin = &adjacency[offsets[v]], *end = begin + live[v];
+				std::swap(*std::find(begin, end, (uint32_t)best), end[-1]);
+				live[v] -= 1;
+				nextCache[nextCount++] = v;
+			}
+			for (size_t i = 0; i < cacheCount; ++i) {
+				uint32_t v = cache[i];
+				if (v != triangle[0] && v != triangle[1] && v != triangle[2]) nextCache[nextCount++] = v;
+			}
+
+			// Rescore what is in the cache, including the vertices that just
+			// fell out of it, and pick the best triangle among theirs.
+			best = (size_t)-1;
+			float bestScore = -1.0f;
+			for (size_t i = 0; i < nextCount; ++i) {
+				uint32_t v = nextCache[i];
+				cachePosition[v] = i < cacheSize ? (int32_t)i : -1;
+				float updated = score(v), delta = updated - vertexScore[v];
+				vertexScore[v] = updated;
+				for (uint32_t j = offsets[v]; j < offsets[v] + live[v]; ++j) {
+					uint32_t t = adjacency[j];
+					triangleScore[t] += delta;
+					if (triangleScore[t] > bestScore) {
+						bestScore = triangleScore[t];
+						best = t;
+					}
+				}
+			}
+			cacheCount = std::min(nextCount, cacheSize);
+			std::copy(nextCache, nextCache + cacheCount, cache);
+		}
+		indices.swap(output);
+	}
+
+	/// Splits the cache ordered triangles into clusters and sorts the clusters
+	/// front to back from the mesh's centre outward, after Sander et al., "Fast
+	/// Triangle Reordering for Vertex Locality and Reduced Overdraw". Clusters
+	/// start where all three vertices of a triangle miss the cache, and are
+	/// cut further wherever the misses so far stay within `threshold` of the
+	/// whole cluster's, so cutting costs little cache efficiency.
+	static void OptimizeOverdraw_(
+		std::vector<uint32_t> &indices,
+		const std::vector<float> &positions,
+		size_t vertexCount,
+		size_t cacheSize,
+		float threshold
+	) {
+		size_t triangleCount = indices.size() / 3;
+		if (triangleCount < 2) return;
+
+		std::vector<size_t> loadedAt(vertexCount, 0);
+		size_t time = cacheSize + 1;
+		auto misses = [&](size_t t) {
+			size_t count = 0;
+			for (size_t k = 0; k < 3; ++k) {
+				uint32_t v = indices[t * 3 + k];
+				if (time - loadedAt[v] > cacheSize) {
+					loadedAt[v] = time++;
+					count += 1;
+				}
+			}
+			return count;
+		};
+		auto flush = [&] { time += cacheSize + 1; };
+
+		std::vector<size_t> hard;
+		for (size_t t = 0; t < triangleCount; ++t) {
+			if (misses(t) == 3 || t == 0) hard.push_back(t);
+		}
+		hard.push_back(triangleCount);
+
+		std::vector<size_t> clusters;
+		for (size_t h = 0; h + 1 < hard.size(); ++h) {
+			size_t begin = hard[h], end = hard[h + 1];
+			flush();
+			size_t total = 0;
+			for (size_t t = begin; t < end; ++t) total += misses(t);
+			float limit = threshold * (float)total / (float)(end - begin);
+
+			flush();
+			clusters.push_back(begin);
+			size_t runningMisses = 0, runningCount = 0;
+			for (size_t t = begin; t < end; ++t) {
+				runningMisses += misses(t);
+				runningCount += 1;
+				if (t + 1 < end && (float)runningMisses / (float)runningCount <= limit) {
+					clusters.push_back(t + 1);
+					runningMisses = runningCount = 0;
+					flush();
+				}
+			}
+		}
+		clusters.push_back(triangleCount);
+
+		double centre[3] = {};
+		for (size_t v = 0; v < vertexCount; ++v) {
+			for (size_t k = 0; k < 3; ++k) centre[k] += positions[v * 3 + k];
+		}
+		for (size_t k = 0; k < 3; ++k) centre[k] /= (double)(vertexCount ? vertexCount : 1);
+
+		// How far a cluster faces away from the centre: the area weighted
+		// centroid's offset along the average normal.
+		size_t clusterCount = clusters.size() - 1;
+		std::vector<float> keys(clusterCount);
+		for (size_t c = 0; c < clusterCount; ++c) {
+			double centroid[3] = {}, normal[3] = {}, area = 0.0;
+			for (size_t t = clusters[c]; t < clusters[c + 1]; ++t) {
+				const float *a = &positions[indices[t * 3] * 3], *b = &positions[indices[t * 3 + 1] * 3], *p = &positions[indices[t * 3 + 2] * 3];
+				double e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] }, e2[3] = { p[0] - a[0], p[1] - a[1], p[2] - a[2] };
+				double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+				double weight = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+				for (size_t k = 0; k < 3; ++k) {
+					centroid[k] += (a[k] + b[k] + p[k]) / 3.0 * weight;
+					normal[k] += n[k];
+				}
+				area += weight;
+			}
+			double length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+			double key = 0.0;
+			if (area > 0.0 && length > 0.0) {
+				for (size_t k = 0; k < 3; ++k) key += (centroid[k] / area - centre[k]) * normal[k] / length;
+			}
+			keys[c] = (float)key;
+		}
+
+		std::vector<uint32_t> order(clusterCount);
+		for (size_t c = 0; c < clusterCount; ++c) order[c] = c;
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return keys[a] > keys[b]; });
+
+		std::vector<uint32_t> output;
+		output.reserve(indices.size());
+		for (uint32_t c : order) {
+			output.insert(output.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+		}
+		indices.swap(output);
+	}
+
+	/// Decodes attribute 0 as positions, or returns false if it can't be one.
+	static bool ReadPositions_(
+		const uint8_t *vertices,
+		size_t vertexCount,
+		const VertexSpecification &spec,
+		std::vector<float> &positions
+	) {
+		if (spec.Attributes.GetCount() == 0) return false;
+		const auto &attribute = spec.Attributes[0];
+		if (attribute.Divisor != 0 || attribute.Dimension < 3) return false;
+		if (attribute.Type != DataType::Float32 && attribute.Type != DataType::Float64 && attribute.Type != DataType::Half16) return false;
+
+		size_t stride = spec.PackedSize(), elementSize = attribute.GetElementSize();
+		positions.resize(vertexCount * 3);
+		for (size_t v = 0; v < vertexCount; ++v) {
+			for (size_t k = 0; k < 3; ++k) {
+				const uint8_t *p = vertices + v * stride + k * elementSize;
+				float value;
+				if (attribute.Type == DataType::Float32) {
+					CopyItems((uint8_t*)&value, p, sizeof(value));
+				} else if (attribute.Type == DataType::Float64) {
+					double d;
+					CopyItems((uint8_t*)&d, p, sizeof(d));
+					value = (float)d;
+				} else {
+					uint16_t h;
+					CopyItems((uint8_t*)&h, p, sizeof(h));
+					value = HalfToFloat(h);
+				}
+				positions[v * 3 + k] = value;
+			}
+		}
+		return true;
+	}
+
+	void OptimizeMesh(
+		Span<const uint8_t> vertexData,
+		Span<const uint8_t> indexData,
+		const VertexSpecification &spec,
+		OptimizedMesh &out,
+		const MeshOptimizeOptions &options
+	) {
+		size_t stride = spec.PackedSize();
+		size_t vertexCount = stride ? vertexData.GetByteSize() / stride : 0;
+		bool indexed = indexData.GetByteSize() != 0;
+		size_t indexSize = indexed ? VertexAttribute::GetElementSize(spec.IndexType) : 0;
+		size_t indexCount = indexed ? indexData.GetByteSize() / indexSize : vertexCount;
+		indexCount -= indexCount % 3;
+
+		// Triangles referencing vertices that aren't there are dropped before
+		// anything indexes per-vertex tables with them.
+		std::vector<uint32_t> indices;
+		indices.reserve(indexCount);
+		for (size_t t = 0; t < indexCount / 3; ++t) {
+			uint32_t triangle[3];
+			for (size_t k = 0; k < 3; ++k) {
+				triangle[k] = indexed ? ReadIndex_(indexData.GetData(), indexSize, t * 3 + k) : t * 3 + k;
+			}
+			if (triangle[0] >= vertexCount || triangle[1] >= vertexCount || triangle[2] >= vertexCount) continue;
+			indices.insert(indices.end(), triangle, triangle + 3);
+		}
+		out.Stats = {};
+		out.Stats.InputVertexCount = vertexCount;
+		out.Stats.AcmrBefore = ComputeAcmr({ indices.data(), indices.size() }, vertexCount, options.CacheSize);
+
+		// Welded vertices are represented by the first input vertex of each
+		// group until the final reordering copies them out.
+		std::vector<uint32_t> representative(vertexCount);
+		size_t workingCount = vertexCount;
+		for (size_t v = 0; v < vertexCount; ++v) representative[v] = v;
+		if (options.Weld) {
+			std::vector<uint32_t> remap;
+			workingCount = WeldVertices_(vertexData.GetData(), vertexCount, stride, remap);
+			for (size_t v = vertexCount; v-- > 0;) representative[remap[v]] = v;
+			for (auto &index : indices) index = remap[index];
+		}
+
+		size_t kept = 0;
+		for (size_t t = 0; t < indices.size() / 3; ++t) {
+			uint32_t a = indices[t * 3], b = indices[t * 3 + 1], c = indices[t * 3 + 2];
+			if (a == b || b == c || a == c) continue;
+			indices[kept++] = a;
+			indices[kept++] = b;
+			indices[kept++] = c;
+		}
+		indices.resize(kept);
+
+		if (options.OptimizeVertexCache) {
+			OptimizeVertexCache_(indices, workingCount);
+			std::vector<float> positions, welded;
+			if (options.OptimizeOverdraw && ReadPositions_(vertexData.GetData(), vertexCount, spec, positions)) {
+				welded.resize(workingCount * 3);
+				for (size_t v = 0; v < workingCount; ++v) {
+					std::copy_n(&positions[representative[v] * 3], 3, &welded[v * 3]);
+				}
+				OptimizeOverdraw_(indices, welded, workingCount, options.CacheSize, options.OverdrawThreshold);
+			}
+		}
+
+		// Number vertices in the order they're first drawn, so fetching them
+		// walks the vertex buffer forwards. Unreferenced ones are dropped.
+		std::vector<uint32_t> renumber(workingCount, 0xFFFFFFFF);
+		size_t outputCount = 0;
+		for (auto &index : indices) {
+			if (renumber[index] == 0xFFFFFFFF) {
+				renumber[index] = outputCount++;
+			}
+			index = renumber[index];
+		}
+		out.VertexData.Resize(outputCount * stride);
+		for (size_t v = 0; v < workingCount; ++v) {
+			if (renumber[v] == 0xFFFFFFFF) continue;
+			CopyItems(out.VertexData.GetData() + renumber[v] * stride, vertexData.GetData() + representative[v] * stride, stride);
+		}
+
+		out.IndexType = outputCount <= 0xFFFF ? DataType::UInt16 : DataType::UInt32;
+		size_t outputIndexSize = VertexAttribute::GetElementSize(out.IndexType);
+		out.IndexData.Resize(indices.size() * outputIndexSize);
+		for (size_t i = 0; i < indices.size(); ++i) {
+			if (outputIndexSize == 2) {
+				uint16_t v = indices[i];
+				CopyItems(out.IndexData.GetData() + i * 2, (const uint8_t*)&v, 2);
+			} else {
+				CopyItems(out.IndexData.GetData() + i * 4, (const uint8_t*)&indices[i], 4);
+			}
+		}
+
+		out.Stats.OutputVertexCount = outputCount;
+		out.Stats.TriangleCount = indices.size() / 3;
+		out.Stats.AcmrAfter = ComputeAcmr({ indices.data(), indices.size() }, outputCount, options.CacheSize);
+	}
+
+	Owned<Mesh> CreateOptimizedMesh(
+		Renderer &renderer,
+		Span<const uint8_t> vertexData,
+		Span<const uint8_t> indexData,
+		const VertexSpecification &spec,
+		const MeshOptimizeOptions &options,
+		MeshOptimizeStats *stats
+	) {
+		OptimizedMesh optimized;
+		OptimizeMesh(vertexData, indexData, spec, optimized, options);
+		if (stats) *stats = optimized.Stats;
+
+		VertexSpecification optimizedSpec = spec.Copy();
+		optimizedSpec.IndexType = optimized.IndexType;
+		return renderer.CreateMesh(optimized.VertexData, optimized.IndexData, optimizedSpec);
+	}
+}
@@ -0,0 +1,287 @@
+#include <av/av.hh>
+#include <av/null.hh>
+#include <av/render.hh>
+#include <fmt/core.h>
+
+namespace av::graphics {
+	class Null_MeshPool : public MeshPool {
+	public:
+		using MeshPool::MeshPool;
+
+		size_t UsedVertices = 0, UsedIndices = 0;
+	};
+
+	class Null_Bundle : public Bundle {
+	public:
+		using Bundle::Bundle;
+
+		/// Private copy of the recorded stream and arena.
+		GrowingSpan<uint8_t> Data, Arena;
+	};
+
+	void Null_UniformArena::Create(size_t regionSize) {
+		RegionSize_ = regionSize;
+		Memory_.Resize(regionSize * Renderer::FramesInFlight);
+		Slot_ = 0;
+		Cursor_.store(0, std::memory_order_relaxed);
+	}
+
+	void Null_UniformArena::BeginFrame(size_t slot) {
+		Slot_ = slot;
+		Cursor_.store(0, std::memory_order_relaxed);
+	}
+
+	UniformArena::Allocation Null_UniformArena::Allocate(size_t size) {
+		// Same alignment as the common GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT.
+		const size_t alignment = 256;
+		size_t base = Slot_ * RegionSize_;
+		size_t cursor = Cursor_.load(std::memory_order_relaxed);
+		size_t offset;
+		do {
+			offset = (base + cursor + alignment - 1) / alignment * alignment;
+			if (offset + size > base + RegionSize_) return { nullptr, 0 };
+		} while (!Cursor_.compare_exchange_weak(cursor, offset + size - base, std::memory_order_relaxed));
+		return { Memory_.GetData() + offset, (uint32_t)offset };
+	}
+
+	Null_Renderer::Stats &Null_Renderer::Stats::operator+=(const Stats &other) {
+		Commands += other.Commands;
+		Draws += other.Draws;
+		DrawCalls += other.DrawCalls;
+		Instances += other.Instances;
+		Triangles += other.Triangles;
+		ShaderBinds += other.ShaderBinds;
+		ShaderChanges += other.ShaderChanges;
+		MeshChanges += other.MeshChanges;
+		Uniforms += other.Uniforms;
+		UniformBytes += other.UniformBytes;
+		UniformBlocks += other.UniformBlocks;
+		UniformBlockBytes += other.UniformBlockBytes;
+		Clears += other.Clears;
+		BundlesExecuted += other.BundlesExecuted;
+		Markers += other.Markers;
+		StreamBytes += other.StreamBytes;
+		ArenaBytes += other.ArenaBytes;
+		StaleDraws += other.StaleDraws;
+		return *this;
+	}
+
+	void Null_Renderer::Initialize() {
+		UniformArena_.Create(UniformArenaSize);
+		Last_ = {};
+		Total_ = {};
+	}
+
+	void Null_Renderer::DeInitialize() {
+	}
+
+	void Null_Renderer::WaitForFrame_(size_t slot) {
+		// Nothing is ever in flight.
+	}
+
+	UniformArena *Null_Renderer::BeginUniformArena_(size_t slot) {
+		UniformArena_.BeginFrame(slot);
+		return &UniformArena_;
+	}
+
+	void Null_Renderer::SignalFrame_(size_t slot, uint64_t frame) {
+	}
+
+	/// Records the mesh in the slot map and creates its object.
+	static Owned<Mesh> AddMesh_(
+		SlotMap<Mesh, Null_MeshRecord> &meshes, Null_MeshPool *pool,
+		bool indexed, size_t vertexCount, size_t indexCount, const VertexSpecification &spec
+	) {
+		auto handle = meshes.Insert({ pool, (uint32_t)vertexCount, (uint32_t)indexCount, spec.Hash(), indexed });
+		if (!handle.IsValid()) return {};
+		return Owned<Mesh>(new Mesh(handle, indexed, vertexCount, indexCount, spec));
+	}
+
+	Owned<Mesh> Null_Renderer::CreateMesh(
+		Span<uint8_t> vertexData,
+		Span<uint8_t> indexData,
+		const VertexSpecification &spec
+	) {
+		return AddMesh_(
+			Meshes_, nullptr, true,
+			vertexData.GetByteSize() / spec.PackedSize(),
+			indexData.GetByteSize() / VertexAttribute::GetElementSize(spec.IndexType),
+			spec
+		);
+	}
+
+	Owned<Mesh> Null_Renderer::CreateMesh(
+		Span<uint8_t> vertexData,
+		const VertexSpecification &spec
+	) {
+		return AddMesh_(Meshes_, nullptr, false, vertexData.GetByteSize() / spec.PackedSize(), 0, spec);
+	}
+
+	Owned<MeshPool> Null_Renderer::CreateMeshPool(
+		const VertexSpecification &spec,
+		size_t vertexCapacity,
+		size_t indexCapacity
+	) {
+		return Owned<MeshPool>(new Null_MeshPool(spec, vertexCapacity, indexCapacity));
+	}
+
+	Owned<Mesh> Null_Renderer::CreateMesh(
+		Ref<MeshPool> pool_,
+		Span<uint8_t> vertexData,
+		Span<uint8_t> indexData
+	) {
+		auto *pool = (Null_MeshPool*)pool_.Get();
+		const auto &spec = pool->GetVertexSpec();
+		size_t vertexCount = vertexData.GetByteSize() / spec.PackedSize();
+		size_t indexCount = indexData.GetByteSize() / VertexAttribute::GetElementSize(spec.IndexType);
+		if (pool->UsedVertices + vertexCount > pool->GetVertexCapacity()) return {};
+		if (pool->UsedIndices + indexCount > pool->GetIndexCapacity()) return {};
+
+		auto mesh = AddMesh_(Meshes_, pool, true, vertexCount, indexCount, spec);
+		if (!mesh.Get()) return {};
+		pool->UsedVertices += vertexCount;
+		pool->UsedIndices += indexCount;
+		return Owned<Mesh>(mesh.Release());
+	}
+
+	Owned<Shader> Null_Renderer::CreateShader(const char *vertexSource, const char *fragmentSource) {
+		auto handle = Shaders_.Insert(nullptr);
+		if (!handle.IsValid()) return {};
+		auto *shader = new Shader(handle);
+		*Shaders_.Get(handle) = shader;
+		return Owned<Shader>(shader);
+	}
+
+	Owned<Bundle> Null_Renderer::CreateBundle(Ref<CommandBuffer> cmdBuf) {
+		auto recorded = cmdBuf->GetData();
+		auto arena = cmdBuf->GetArena();
+		if (!ValidateBundleData(recorded, arena)) return {};
+
+		auto *bundle = new Null_Bundle(cmdBuf->GetCount());
+		CopyItems(bundle->Data.Extend(recorded.GetCount()), recorded.GetData(), recorded.GetCount());
+		if (arena.GetCount()) CopyItems(bundle->Arena.Extend(arena.GetCount()), arena.GetData(), arena.GetCount());
+		return Owned<Bundle>(bundle);
+	}
+
+	void Null_Renderer::DestroyBundle(Owned<Bundle> &&bundle) {
+	}
+
+	void Null_Renderer::DestroyMesh(Owned<Mesh> &&mesh) {
+		auto *record = Meshes_.Get(mesh->GetHandle());
+		if (!record) return;
+		if (record->Pool) {
+			record->Pool->UsedVertices -= record->VertexCount;
+			record->Pool->UsedIndices -= record->IndexCount;
+		}
+		Meshes_.Remove(mesh->GetHandle());
+	}
+
+	void Null_Renderer::DestroyMeshPool(Owned<MeshPool> &&pool) {
+	}
+
+	void Null_Renderer::DestroyShader(Owned<Shader> &&shader) {
+		Shaders_.Remove(shader->GetHandle());
+	}
+
+	static size_t CountTriangles_(const Null_MeshRecord &mesh) {
+		return (mesh.Indexed ? mesh.IndexCount : mesh.VertexCount) / 3;
+	}
+
+	static bool BatchesWith_(const Null_MeshRecord &a, const Null_MeshRecord &b) {
+		if (!a.Indexed || !b.Indexed || a.Pool != b.Pool) return false;
+		return a.Pool || a.Layout == b.Layout;
+	}
+
+	void Null_Renderer::Execute_(Executor_ &executor, Span<const uint8_t> data, Span<const uint8_t> arena) {
+		auto &counts = executor.Counts;
+		// Returns the mesh, or null for a stale handle.
+		auto drawn = [&](MeshHandle handle, size_t instances) -> const Null_MeshRecord* {
+			const auto *mesh = Meshes_.Get(handle);
+			if (!mesh) {
+				counts.StaleDraws += 1;
+				return nullptr;
+			}
+			counts.Draws += 1;
+			counts.Instances += instances;
+			counts.Triangles += CountTriangles_(*mesh) * instances;
+			if (handle != executor.LastMesh) counts.MeshChanges += 1;
+			executor.LastMesh = handle;
+			return mesh;
+		};
+
+		CommandBufferReader reader(data, arena);
+		while (true) {
+			auto type = reader.ReadType();
+			if (type == CommandType::End) break;
+			counts.Commands += 1;
+
+			switch (type) {
+			case CommandType::DrawMesh: {
+				if (drawn(reader.ReadCmdDrawMesh(), 1)) counts.DrawCalls += 1;
+			} break;
+			case CommandType::DrawMeshInstanced: {
+				auto instanced = reader.ReadCmdDrawMeshInstanced();
+				if (drawn(instanced.DrawnMesh, instanced.InstanceCount)) counts.DrawCalls += 1;
+			} break;
+			case CommandType::DrawMeshes: {
+				// Mirrors the GL backend: one call per run of indexed meshes from
+				// a pool, or from the mesh heap, which groups meshes by layout.
+				const Null_MeshRecord *last = nullptr;
+				for (auto handle : reader.ReadCmdDrawMeshes()) {
+					const auto *mesh = drawn(handle, 1);
+					if (!mesh) continue;
+					if (!last || !BatchesWith_(*last, *mesh)) counts.DrawCalls += 1;
+					last = mesh;
+				}
+			} break;
+			case CommandType::BindShader: {
+				auto shader = reader.ReadCmdBindShader();
+				counts.ShaderBinds += 1;
+				if (shader != executor.BoundShader) counts.ShaderChanges += 1;
+				executor.BoundShader = shader;
+			} break;
+			case CommandType::ExecuteBundle: {
+				auto *bundle = (const Null_Bundle*)reader.ReadCmdExecuteBundle();
+				counts.BundlesExecuted += 1;
+				Execute_(executor, bundle->Data, bundle->Arena);
+			} break;
+			case CommandType::Uniform: {
+				auto uniform = reader.ReadCmdUniform();
+				counts.Uniforms += 1;
+				counts.UniformBytes += uniform.Data.GetCount();
+			} break;
+			case CommandType::UniformBlock: {
+				auto block = reader.ReadCmdUniformBlock();
+				counts.UniformBlocks += 1;
+				counts.UniformBlockBytes += block.Size;
+			} break;
+			case CommandType::Clear: {
+				reader.ReadCmdClear();
+				counts.Clears += 1;
+			} break;
+			case CommandType::BeginMarker: {
+				reader.ReadCmdBeginMarker();
+				counts.Markers += 1;
+			} break;
+			case CommandType::EndMarker:
+				reader.ReadCmdEndMarker();
+				break;
+			default:
+				fmt::print(stderr, "Unknown command {:#x} in command buffer\n", (int)type);
+				return;
+			}
+		}
+	}
+
+	void Null_Renderer::FlushCommandBuffers(Span<const Ref<CommandBuffer>> cmdBufs) {
+		Last_ = {};
+		Executor_ executor { Last_ };
+		for (const auto &cmdBuf : cmdBufs) {
+			if (cmdBuf->GetCount() == 0) continue;
+			Last_.StreamBytes += cmdBuf->GetData().GetCount();
+			Last_.ArenaBytes += cmdBuf->GetArena().GetCount();
+			Execute_(executor, cmdBuf->GetData(), cmdBuf->GetArena());
+		}
+		Total_ += Last_;
+	}
+}
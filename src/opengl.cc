@@ -3,76 +3,578 @@
 #include <av/render.hh>
 #include <GL/gl3w.h>
 #include <fmt/core.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
 
 namespace av::graphics {
-	class OpenGL_Mesh : public Mesh {
+	/// First-fit allocator over [0, capacity). Free ranges are kept sorted by
+	/// offset and merged with their neighbours when released.
+	class RangeAllocator_ {
 	public:
-		GLuint VAO, VBO, EBO;
+		void Create(size_t capacity) {
+			Capacity_ = capacity;
+			Free_.Clear();
+			if (capacity) Free_.Push({ 0, capacity });
+		}
+
+		bool Allocate(size_t size, size_t &offset) {
+			if (size == 0) { offset = 0; return true; }
+			for (size_t i = 0; i < Free_.GetCount(); ++i) {
+				auto &range = Free_[i];
+				if (range.Size < size) continue;
+				offset = range.Offset;
+				range.Offset += size;
+				range.Size -= size;
+				if (range.Size == 0) Erase_(i);
+				return true;
+			}
+			return false;
+		}
 
-		OpenGL_Mesh(bool indexed, size_t vertexCount, size_t indexCount, const VertexSpecification &spec)
-			: Mesh(indexed, vertexCount, indexCount, spec) {}
+		void Free(size_t offset, size_t size) {
+			if (size == 0) return;
+			size_t i = 0;
+			while (i < Free_.GetCount() && Free_[i].Offset < offset) ++i;
+
+			bool mergesPrev = i > 0 && Free_[i - 1].Offset + Free_[i - 1].Size == offset;
+			bool mergesNext = i < Free_.GetCount() && offset + size == Free_[i].Offset;
+			if (mergesPrev && mergesNext) {
+				Free_[i - 1].Size += size + Free_[i].Size;
+				Erase_(i);
+			} else if (mergesPrev) {
+				Free_[i - 1].Size += size;
+			} else if (mergesNext) {
+				Free_[i].Offset = offset;
+				Free_[i].Size += size;
+			} else {
+				Free_.Extend(1);
+				for (size_t j = Free_.GetCount() - 1; j > i; --j) Free_[j] = Free_[j - 1];
+				Free_[i] = { offset, size };
+			}
+		}
+
+		size_t GetCapacity() const { return Capacity_; }
+		size_t GetFreeRangeCount() const { return Free_.GetCount(); }
+
+		size_t GetFreeSize() const {
+			size_t total = 0;
+			for (const auto &range : Free_) total += range.Size;
+			return total;
+		}
+
+		size_t GetLargestFree() const {
+			size_t largest = 0;
+			for (const auto &range : Free_) largest = range.Size > largest ? range.Size : largest;
+			return largest;
+		}
+
+		/// Whether the free space is all in one range at the end.
+		bool IsCompact() const {
+			return Free_.GetCount() == 0
+				|| (Free_.GetCount() == 1 && Free_[0].Offset + Free_[0].Size == Capacity_);
+		}
+
+	private:
+		struct Range_ {
+			size_t Offset, Size;
+		};
+
+		void Erase_(size_t i) {
+			for (size_t j = i + 1; j < Free_.GetCount(); ++j) Free_[j - 1] = Free_[j];
+			Free_.Resize(Free_.GetCount() - 1);
+		}
+
+		GrowingSpan<Range_> Free_;
+		size_t Capacity_ = 0;
+	};
+
+	/// Vertex and index buffers carved up between meshes, drawn through the
+	/// shared VAO of their layout. Backs both user-created pools and the
+	/// blocks of the mesh heap.
+	class OpenGL_MeshPool : public MeshPool {
+	public:
+		GLuint VBO, EBO;
+		OpenGL_VertexArrayCache::Layout *Layout;
+
+		using MeshPool::MeshPool;
 
 	private:
 		friend OpenGL_Renderer;
+		friend OpenGL_MeshHeap;
+		friend OpenGL_DeletionQueue;
+
+		void Create_(OpenGL_VertexArrayCache &vaos);
+		/// Queues the buffers for deletion; the object can go right away.
+		void Destroy_(OpenGL_DeletionQueue &deletions);
 
-		void Create_(Span<uint8_t> vertexData, Span<uint8_t> indexData);
-		void Destroy_();
+		/// Reserves room for a mesh, all or nothing.
+		bool Allocate_(size_t vertexCount, size_t indexCount, size_t &baseVertex, size_t &firstIndex);
+		/// Uploads the data of a mesh allocated here, or copies it from
+		/// `staged` if set, and starts tracking it. The mesh's record gets its
+		/// pool and offsets filled in.
+		void Place_(
+			OpenGL_MeshMap &meshes, MeshHandle mesh, size_t baseVertex, size_t firstIndex,
+			Span<uint8_t> vertexData, Span<uint8_t> indexData, const OpenGL_StagedMesh *staged
+		);
+		/// Stops tracking a mesh. Its ranges are freed once the GPU is done with them.
+		void Remove_(OpenGL_MeshMap &meshes, MeshHandle mesh, OpenGL_DeletionQueue &deletions);
+		/// Copies the live meshes to the front of fresh buffers.
+		void Defragment_(OpenGL_MeshMap &meshes, OpenGL_DeletionQueue &deletions);
+
+		RangeAllocator_ Vertices_, Indices_;
+		/// Live meshes, which Defragment_ has to move.
+		GrowingSpan<MeshHandle> Meshes_;
+	};
+
+	/// A command decoded out of the byte stream. Payloads point into the
+	/// stream they were decoded from.
+	struct OpenGL_Command_ {
+		CommandType Type;
+		union {
+			Bundle *ExecutedBundle;
+			ClearColor Color;
+		};
+		MeshHandle DrawnMesh;
+		ShaderHandle BoundShader;
+		UniformData Uniform;
+		UniformBlockData Block;
+		InstancedDrawData Instanced;
+		Span<const MeshHandle> Meshes;
+		MarkerId Marker;
+	};
+
+	class OpenGL_Bundle : public Bundle {
+	public:
+		/// Private copy of the recorded stream and arena, which Commands point into.
+		GrowingSpan<uint8_t> Data, Arena;
+		GrowingSpan<OpenGL_Command_> Commands;
+
+		using Bundle::Bundle;
 	};
 
+	/// Uploads `count` elements of a uniform with the glProgramUniform* call
+	/// that matches its GLSL type.
+	using UniformUpload_ = void (*)(GLuint program, GLint location, GLsizei count, const void *data);
+
 	class OpenGL_Shader : public Shader {
 	public:
+		/// An active uniform, as introspected at link time.
+		struct Uniform {
+			GLint Location;
+			GLenum Type;
+			/// Array length, 1 for plain uniforms.
+			GLint Size;
+			/// Shape of the recorded data the upload takes.
+			DataType ElementType;
+			uint8_t SizeX, SizeY;
+			/// Null for types there is no upload for, such as doubles.
+			UniformUpload_ Upload;
+			/// Set once a mismatching upload has been reported.
+			bool Reported;
+		};
+
+		/// An active vertex shader input; matrices take a location per column.
+		struct VertexInput {
+			GLint Location;
+			GLenum Type;
+			/// Float32, Int32, UInt32 or Float64.
+			DataType ComponentType;
+			uint8_t Locations;
+		};
+
 		GLuint Id;
+		/// Written on the thread that owns the renderer and read by recording
+		/// threads through CheckVertexInputs. Ready is stored with release
+		/// after Reflect_, so whoever loads it with acquire sees the tables,
+		/// which don't change afterwards.
+		std::atomic<ShaderStatus> Status = ShaderStatus::Compiling;
+
+		using Shader::Shader;
+
+		/// The active uniform recorded as `id`, or null.
+		Uniform *GetUniform(UniformId id) {
+			if (!id.IsValid() || id.GetValue() >= UniformSlots_.GetCount()) return nullptr;
+			uint16_t slot = UniformSlots_[id.GetValue()];
+			return slot == NoUniform_ ? nullptr : &Uniforms_[slot];
+		}
+
+		Span<const VertexInput> GetVertexInputs() const { return { Inputs_.GetData(), Inputs_.GetCount() }; }
+
+		/// Compiler and linker output of a failed program, empty otherwise.
+		const char *GetLog() const { return Log_.GetCount() ? Log_.GetData() : ""; }
 
 	private:
 		friend OpenGL_Renderer;
 
-		void Create_(const char *vertexSource, const char *fragmentSource);
-		void Destroy_();
+		/// Loads the program from the cache, or starts compiling and linking it
+		/// without waiting for the result.
+		void Create_(const char *vertexSource, const char *fragmentSource, OpenGL_ProgramCache &cache);
+		/// Finishes a compiling program once the driver is done with it, or
+		/// right away (waiting on the driver) if `wait` is set.
+		void Poll_(OpenGL_ProgramCache &cache, bool wait);
+		void Destroy_(OpenGL_DeletionQueue &deletions);
+		/// Builds the uniform and vertex input tables; the driver isn't asked
+		/// again afterwards.
+		void Reflect_();
+		void AppendLog_(const char *what, const GLchar *log, GLint length);
+
+		static constexpr uint16_t NoUniform_ = 0xFFFF;
+
+		/// Indexed by UniformId, an index into Uniforms_ or NoUniform_.
+		GrowingSpan<uint16_t> UniformSlots_;
+		GrowingSpan<Uniform> Uniforms_;
+		GrowingSpan<VertexInput> Inputs_;
+		GrowingSpan<char> Log_;
+		/// Stages of a program still compiling.
+		GLuint VertexShader_ = 0, FragmentShader_ = 0;
+		uint64_t CacheKey_ = 0;
+		std::chrono::steady_clock::time_point Start_;
 	};
 
 	static GLuint CompileShader_(const char *source, GLenum type) {
 		GLuint shader = glCreateShader(type);
 		glShaderSource(shader, 1, &source, nullptr);
 		glCompileShader(shader);
-		GLint status;
-		glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
-		if (status == GL_FALSE) {
-			OwningSpan<GLchar> log(1024);
-			GLsizei length = 0;
-			glGetShaderInfoLog(shader, log.GetByteSize(), &length, log.GetData());
-			fmt::print(stderr, "Failed to compile {} shader: {}\n",
-				type == GL_VERTEX_SHADER ? "vertex" : "fragment",
-				log.GetData()
-			);
-			exit(1);
-		}
 		return shader;
 	}
 
-	void OpenGL_Shader::Create_(const char *vertexSource, const char *fragmentSource) {
-		GLuint vertShader = CompileShader_(vertexSource, GL_VERTEX_SHADER);
-		GLuint fragShader = CompileShader_(fragmentSource, GL_FRAGMENT_SHADER);
+	void OpenGL_Shader::Create_(const char *vertexSource, const char *fragmentSource, OpenGL_ProgramCache &cache) {
+		CacheKey_ = cache.ComputeKey(vertexSource, fragmentSource);
+		Id = cache.Load(CacheKey_);
+		if (Id) {
+			Reflect_();
+			Status.store(ShaderStatus::Ready, std::memory_order_release);
+			return;
+		}
+
+		// Nothing here queries a status, so with KHR_parallel_shader_compile
+		// the driver compiles and links on its own threads. Link errors
+		// include failed stages, so the program is linked unconditionally.
+		Start_ = std::chrono::steady_clock::now();
+		VertexShader_ = CompileShader_(vertexSource, GL_VERTEX_SHADER);
+		FragmentShader_ = CompileShader_(fragmentSource, GL_FRAGMENT_SHADER);
 
 		Id = glCreateProgram();
-		glAttachShader(Id, vertShader);
-		glAttachShader(Id, fragShader);
+		if (cache.IsEnabled()) glProgramParameteri(Id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		glAttachShader(Id, VertexShader_);
+		glAttachShader(Id, FragmentShader_);
 		glLinkProgram(Id);
-		GLint status = 0;
+		Status = ShaderStatus::Compiling;
+	}
+
+	void OpenGL_Shader::Poll_(OpenGL_ProgramCache &cache, bool wait) {
+		if (Status != ShaderStatus::Compiling) return;
+		if (!wait) {
+			GLint complete = GL_FALSE;
+			glGetProgramiv(Id, GL_COMPLETION_STATUS_KHR, &complete);
+			if (complete == GL_FALSE) return;
+		}
+
+		GLint status = GL_FALSE;
 		glGetProgramiv(Id, GL_LINK_STATUS, &status);
 		if (status == GL_FALSE) {
-			OwningSpan<GLchar> log(1024);
+			GLchar log[1024];
 			GLsizei length = 0;
-			glGetProgramInfoLog(Id, log.GetByteSize(), &length, log.GetData());
-			fmt::print(stderr, "Failed to link program: {}\n", log.GetData());
-			exit(1);
+			const struct { GLuint Shader; const char *Name; } stages[] = {
+				{ VertexShader_, "vertex shader" }, { FragmentShader_, "fragment shader" }
+			};
+			for (const auto &stage : stages) {
+				glGetShaderiv(stage.Shader, GL_COMPILE_STATUS, &status);
+				if (status == GL_TRUE) continue;
+				glGetShaderInfoLog(stage.Shader, sizeof(log), &length, log);
+				AppendLog_(stage.Name, log, length);
+			}
+			glGetProgramInfoLog(Id, sizeof(log), &length, log);
+			AppendLog_("program", log, length);
+			fmt::print(stderr, "Failed to build program: {}\n", GetLog());
+			Status = ShaderStatus::Failed;
+		} else {
+			// Includes however long the program sat finished before this poll,
+			// which is at most a frame.
+			auto elapsed = std::chrono::steady_clock::now() - Start_;
+			cache.Store(CacheKey_, Id, std::chrono::duration<double, std::milli>(elapsed).count());
+			Reflect_();
+			Status.store(ShaderStatus::Ready, std::memory_order_release);
+		}
+
+		glDeleteShader(VertexShader_);
+		glDeleteShader(FragmentShader_);
+		VertexShader_ = FragmentShader_ = 0;
+	}
+
+	void OpenGL_Shader::AppendLog_(const char *what, const GLchar *log, GLint length) {
+		if (Log_.GetCount()) Log_.Resize(Log_.GetCount() - 1);
+		size_t whatLength = strlen(what);
+		char *out = Log_.Extend(whatLength + 2 + length + 1);
+		CopyItems(out, what, whatLength);
+		out[whatLength] = ':';
+		out[whatLength + 1] = ' ';
+		if (length) CopyItems(out + whatLength + 2, log, length);
+		out[whatLength + 2 + length] = '\0';
+	}
+
+	static uint64_t HashBytes_(uint64_t hash, const void *data, size_t size) {
+		auto *bytes = (const uint8_t*)data;
+		for (size_t i = 0; i < size; ++i) {
+			hash ^= bytes[i];
+			hash *= 0x100000001b3;
+		}
+		return hash;
+	}
+
+	static uint64_t HashString_(uint64_t hash, const char *string) {
+		// The terminator keeps ("ab", "c") and ("a", "bc") apart.
+		return HashBytes_(hash, string ? string : "", (string ? strlen(string) : 0) + 1);
+	}
+
+	static constexpr uint32_t ProgramCacheMagic_ = 0x42505641; // "AVPB"
+
+	/// Header of a cache file, followed by the binary.
+	struct ProgramCacheHeader_ {
+		uint32_t Magic;
+		uint32_t Format;
+		uint64_t Key;
+		uint64_t Size;
+		double CompileMs;
+	};
+
+	void OpenGL_ProgramCache::Initialize(const char *directory) {
+		Enabled_ = false;
+		Stats_ = {};
+		if (!directory) return;
+
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		if (formats == 0) return;
+
+		if (strlen(directory) >= sizeof(Directory_) || !fs::CreateDirectory(directory)) {
+			fmt::print(stderr, "Program cache directory {} isn't usable\n", directory);
+			return;
+		}
+		strcpy(Directory_, directory);
+
+		uint64_t hash = 0xcbf29ce484222325;
+		hash = HashString_(hash, (const char*)glGetString(GL_VENDOR));
+		hash = HashString_(hash, (const char*)glGetString(GL_RENDERER));
+		hash = HashString_(hash, (const char*)glGetString(GL_VERSION));
+		DriverHash_ = hash;
+		Enabled_ = true;
+	}
+
+	uint64_t OpenGL_ProgramCache::ComputeKey(const char *vertexSource, const char *fragmentSource) const {
+		uint64_t hash = HashString_(DriverHash_, vertexSource);
+		return HashString_(hash, fragmentSource);
+	}
+
+	void OpenGL_ProgramCache::GetPath_(uint64_t key, char *path, size_t size) const {
+		snprintf(path, size, "%s/%016llx.bin", Directory_, (unsigned long long)key);
+	}
+
+	uint32_t OpenGL_ProgramCache::Load(uint64_t key) {
+		if (!Enabled_) return 0;
+		auto start = std::chrono::steady_clock::now();
+
+		char path[320];
+		GetPath_(key, path, sizeof(path));
+		FILE *file = fopen(path, "rb");
+		if (!file) {
+			Stats_.Misses += 1;
+			return 0;
+		}
+
+		ProgramCacheHeader_ header;
+		GLuint program = 0;
+		bool valid = fread(&header, sizeof(header), 1, file) == 1
+			&& header.Magic == ProgramCacheMagic_
+			&& header.Key == key
+			&& header.Size == fs::GetFileSize(file) - sizeof(header);
+		if (valid) {
+			OwningSpan<uint8_t> binary(header.Size);
+			if (fread(binary.GetData(), 1, header.Size, file) == header.Size) {
+				program = glCreateProgram();
+				glProgramBinary(program, header.Format, binary.GetData(), header.Size);
+				GLint status = GL_FALSE;
+				glGetProgramiv(program, GL_LINK_STATUS, &status);
+				if (status == GL_FALSE) {
+					glDeleteProgram(program);
+					program = 0;
+				}
+			}
+		}
+		fclose(file);
+
+		if (!program) {
+			// Compiling overwrites the file with a binary the driver accepts.
+			Stats_.Rejected += 1;
+			Stats_.Misses += 1;
+			return 0;
+		}
+
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		Stats_.Hits += 1;
+		Stats_.LoadMs += elapsed;
+		Stats_.SavedMs += header.CompileMs - elapsed;
+		return program;
+	}
+
+	void OpenGL_ProgramCache::Store(uint64_t key, uint32_t program, double compileMs) {
+		Stats_.CompileMs += compileMs;
+		if (!Enabled_) return;
+
+		GLint size = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+		if (size <= 0) return;
+
+		ProgramCacheHeader_ header { ProgramCacheMagic_, 0, key, (uint64_t)size, compileMs };
+		OwningSpan<uint8_t> binary(size);
+		GLenum format = 0;
+		glGetProgramBinary(program, size, nullptr, &format, binary.GetData());
+		header.Format = format;
+
+		// Written aside and renamed, so a crash never leaves a torn file behind.
+		char path[320], temporary[328];
+		GetPath_(key, path, sizeof(path));
+		snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+		FILE *file = fopen(temporary, "wb");
+		if (!file) {
+			fmt::print(stderr, "Failed to open {} for writing\n", temporary);
+			return;
 		}
+		bool written = fwrite(&header, sizeof(header), 1, file) == 1
+			&& fwrite(binary.GetData(), 1, size, file) == (size_t)size;
+		written = fclose(file) == 0 && written;
+		if (!written || rename(temporary, path) != 0) {
+			fmt::print(stderr, "Failed to write program cache file {}\n", path);
+			remove(temporary);
+		}
+	}
 
-		glDeleteShader(vertShader);
-		glDeleteShader(fragShader);
+	/// Fills in the recorded shape and the upload call of a GLSL uniform type.
+	/// Returns false for types CmdUniform can't set, such as doubles.
+	static bool DescribeUniformType_(GLenum type, OpenGL_Shader::Uniform &uniform) {
+		#define AV_UPLOAD_(call, T) [](GLuint p, GLint l, GLsizei c, const void *v) { call(p, l, c, (const T*)v); }
+		#define AV_UPLOAD_MATRIX_(call) [](GLuint p, GLint l, GLsizei c, const void *v) { call(p, l, c, GL_FALSE, (const GLfloat*)v); }
+		auto set = [&](DataType elementType, uint8_t x, uint8_t y, UniformUpload_ upload) {
+			uniform.ElementType = elementType;
+			uniform.SizeX = x;
+			uniform.SizeY = y;
+			uniform.Upload = upload;
+			return upload != nullptr;
+		};
+		switch (type) {
+		case GL_FLOAT: return set(DataType::Float32, 1, 1, AV_UPLOAD_(glProgramUniform1fv, GLfloat));
+		case GL_FLOAT_VEC2: return set(DataType::Float32, 2, 1, AV_UPLOAD_(glProgramUniform2fv, GLfloat));
+		case GL_FLOAT_VEC3: return set(DataType::Float32, 3, 1, AV_UPLOAD_(glProgramUniform3fv, GLfloat));
+		case GL_FLOAT_VEC4: return set(DataType::Float32, 4, 1, AV_UPLOAD_(glProgramUniform4fv, GLfloat));
+		case GL_FLOAT_MAT2: return set(DataType::Float32, 2, 2, AV_UPLOAD_MATRIX_(glProgramUniformMatrix2fv));
+		case GL_FLOAT_MAT3: return set(DataType::Float32, 3, 3, AV_UPLOAD_MATRIX_(glProgramUniformMatrix3fv));
+		case GL_FLOAT_MAT4: return set(DataType::Float32, 4, 4, AV_UPLOAD_MATRIX_(glProgramUniformMatrix4fv));
+		case GL_INT: case GL_BOOL:
+			return set(DataType::Int32, 1, 1, AV_UPLOAD_(glProgramUniform1iv, GLint));
+		case GL_INT_VEC2: case GL_BOOL_VEC2:
+			return set(DataType::Int32, 2, 1, AV_UPLOAD_(glProgramUniform2iv, GLint));
+		case GL_INT_VEC3: case GL_BOOL_VEC3:
+			return set(DataType::Int32, 3, 1, AV_UPLOAD_(glProgramUniform3iv, GLint));
+		case GL_INT_VEC4: case GL_BOOL_VEC4:
+			return set(DataType::Int32, 4, 1, AV_UPLOAD_(glProgramUniform4iv, GLint));
+		case GL_UNSIGNED_INT: return set(DataType::UInt32, 1, 1, AV_UPLOAD_(glProgramUniform1uiv, GLuint));
+		case GL_UNSIGNED_INT_VEC2: return set(DataType::UInt32, 2, 1, AV_UPLOAD_(glProgramUniform2uiv, GLuint));
+		case GL_UNSIGNED_INT_VEC3: return set(DataType::UInt32, 3, 1, AV_UPLOAD_(glProgramUniform3uiv, GLuint));
+		case GL_UNSIGNED_INT_VEC4: return set(DataType::UInt32, 4, 1, AV_UPLOAD_(glProgramUniform4uiv, GLuint));
+		case GL_SAMPLER_2D: return set(DataType::Uniform_Sampler2D, 1, 1, AV_UPLOAD_(glProgramUniform1iv, GLint));
+		case GL_SAMPLER_CUBE: return set(DataType::Uniform_SamplerCube, 1, 1, AV_UPLOAD_(glProgramUniform1iv, GLint));
+		default: return set(DataType::Float32, 0, 0, nullptr);
+		}
+		#undef AV_UPLOAD_
+		#undef AV_UPLOAD_MATRIX_
 	}
 
-	void OpenGL_Shader::Destroy_() {
-		glDeleteProgram(Id);
+	/// Fills in the component type and location count of a GLSL input type.
+	static void DescribeInputType_(GLenum type, OpenGL_Shader::VertexInput &input) {
+		input.ComponentType = DataType::Float32;
+		input.Locations = 1;
+		switch (type) {
+		case GL_INT: case GL_INT_VEC2: case GL_INT_VEC3: case GL_INT_VEC4:
+			input.ComponentType = DataType::Int32;
+			break;
+		case GL_UNSIGNED_INT: case GL_UNSIGNED_INT_VEC2: case GL_UNSIGNED_INT_VEC3: case GL_UNSIGNED_INT_VEC4:
+			input.ComponentType = DataType::UInt32;
+			break;
+		case GL_DOUBLE: case GL_DOUBLE_VEC2: case GL_DOUBLE_VEC3: case GL_DOUBLE_VEC4:
+			input.ComponentType = DataType::Float64;
+			break;
+		case GL_FLOAT_MAT2: case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT2x4:
+			input.Locations = 2;
+			break;
+		case GL_FLOAT_MAT3: case GL_FLOAT_MAT3x2: case GL_FLOAT_MAT3x4:
+			input.Locations = 3;
+			break;
+		case GL_FLOAT_MAT4: case GL_FLOAT_MAT4x2: case GL_FLOAT_MAT4x3:
+			input.Locations = 4;
+			break;
+		}
+	}
+
+	void OpenGL_Shader::Reflect_() {
+		GLint count = 0, maxNameLength = 0;
+		glGetProgramInterfaceiv(Id, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+		glGetProgramInterfaceiv(Id, GL_UNIFORM, GL_MAX_NAME_LENGTH, &maxNameLength);
+
+		OwningSpan<GLchar> name(maxNameLength + 1);
+		size_t tableSize = 0;
+
+		UniformSlots_.Clear();
+		Uniforms_.Clear();
+		for (GLint i = 0; i < count; ++i) {
+			const GLenum props[] = { GL_LOCATION, GL_TYPE, GL_ARRAY_SIZE };
+			GLint values[3];
+			glGetProgramResourceiv(Id, GL_UNIFORM, i, 3, props, 3, nullptr, values);
+			// Members of uniform blocks have no location.
+			if (values[0] < 0) continue;
+			glGetProgramResourceName(Id, GL_UNIFORM, i, name.GetCount(), nullptr, name.GetData());
+
+			// Arrays are reported as "name[0]", but recorded by their bare name.
+			// Only a trailing [0] goes: members of arrays of structs, such as
+			// "lights[1].color", are uniforms of their own.
+			size_t length = strlen(name.GetData());
+			if (length > 3 && !strcmp(name.GetData() + length - 3, "[0]")) name[length - 3] = '\0';
+
+			auto id = UniformId::Intern(name.GetData());
+			if (!id.IsValid()) continue;
+			if (id.GetValue() >= tableSize) {
+				UniformSlots_.Resize(id.GetValue() + 1);
+				for (size_t slot = tableSize; slot <= id.GetValue(); ++slot) UniformSlots_[slot] = NoUniform_;
+				tableSize = id.GetValue() + 1;
+			}
+
+			Uniform uniform { values[0], (GLenum)values[1], values[2] };
+			DescribeUniformType_(uniform.Type, uniform);
+			uniform.Reported = false;
+			UniformSlots_[id.GetValue()] = Uniforms_.GetCount();
+			Uniforms_.Push(uniform);
+		}
+
+		glGetProgramInterfaceiv(Id, GL_PROGRAM_INPUT, GL_ACTIVE_RESOURCES, &count);
+		Inputs_.Clear();
+		for (GLint i = 0; i < count; ++i) {
+			const GLenum props[] = { GL_LOCATION, GL_TYPE };
+			GLint values[2];
+			glGetProgramResourceiv(Id, GL_PROGRAM_INPUT, i, 2, props, 2, nullptr, values);
+			// Built-ins such as gl_VertexID have no location.
+			if (values[0] < 0) continue;
+			VertexInput input { values[0], (GLenum)values[1] };
+			DescribeInputType_(input.Type, input);
+			Inputs_.Push(input);
+		}
+	}
+
+	void OpenGL_Shader::Destroy_(OpenGL_DeletionQueue &deletions) {
+		// Stages are only flagged for deletion while attached, so this is
+		// safe even if the driver is still compiling them.
+		if (VertexShader_) glDeleteShader(VertexShader_);
+		if (FragmentShader_) glDeleteShader(FragmentShader_);
+		deletions.ReleaseProgram(Id);
 	}
 
 	GLenum DataTypeToGLenum_(DataType type) {
@@ -89,180 +591,1234 @@ namespace av::graphics {
 			case DataType::UInt8: return GL_UNSIGNED_BYTE;
 			case DataType::Uniform_Sampler2D: return GL_SAMPLER_2D;
 			case DataType::Uniform_SamplerCube: return GL_SAMPLER_CUBE;
+			case DataType::Half16: return GL_HALF_FLOAT;
+			case DataType::Int_2_10_10_10_Rev: return GL_INT_2_10_10_10_REV;
+			case DataType::UInt_2_10_10_10_Rev: return GL_UNSIGNED_INT_2_10_10_10_REV;
 		}
 	}
 
-	void OpenGL_Mesh::Create_(Span<uint8_t> vertexData, Span<uint8_t> indexData) {
-		glCreateVertexArrays(1, &VAO);
-		glCreateBuffers(1, &VBO);
-		if (IsIndexed()) glCreateBuffers(1, &EBO);
-
-		glVertexArrayVertexBuffer(VAO, 0, VBO, 0, GetVertexSpec().PackedSize());
-		if (IsIndexed()) glVertexArrayElementBuffer(VAO, EBO);
-
-		size_t index = 0, offset = 0;
-		for (const auto &attr : GetVertexSpec().Attributes) {
-			glVertexArrayAttribFormat(
-				VAO, index,
-				attr.Dimension,
-				DataTypeToGLenum_(attr.Type),
-				GL_FALSE,
-				offset
-			);
+	/// Describes the layout of `spec` to `vao`; vertex data is read from
+	/// binding 0 and per-instance data from binding 1.
+	static void SetupVertexArray_(GLuint vao, const VertexSpecification &spec) {
+		// The divisor belongs to the binding, so instance attributes share one.
+		size_t index = 0, offset = 0, instanceOffset = 0;
+		for (const auto &attr : spec.Attributes) {
+			GLuint binding = attr.Divisor == 0 ? 0 : 1;
+			size_t &attrOffset = attr.Divisor == 0 ? offset : instanceOffset;
 
-			glVertexArrayAttribBinding(VAO, index, 0);
+			if (attr.IsInteger()) {
+				glVertexArrayAttribIFormat(vao, index, attr.Dimension, DataTypeToGLenum_(attr.Type), attrOffset);
+			} else {
+				glVertexArrayAttribFormat(
+					vao, index,
+					attr.Dimension,
+					DataTypeToGLenum_(attr.Type),
+					attr.Normalized ? GL_TRUE : GL_FALSE,
+					attrOffset
+				);
+			}
+
+			glVertexArrayAttribBinding(vao, index, binding);
+			if (binding == 1) glVertexArrayBindingDivisor(vao, 1, attr.Divisor);
 
-			glEnableVertexArrayAttrib(VAO, index);
+			glEnableVertexArrayAttrib(vao, index);
 
-			offset += attr.GetPackedSize();
+			attrOffset += attr.GetPackedSize();
 			index += 1;
 		}
+	}
+
+	OpenGL_VertexArrayCache::Layout *OpenGL_VertexArrayCache::Acquire(const VertexSpecification &spec) {
+		// The element buffer is attached per draw, so specs that only differ
+		// in index type share a VAO.
+		uint64_t hash = spec.HashAttributes();
+		auto range = Layouts_.equal_range(hash);
+		for (auto it = range.first; it != range.second; ++it) {
+			if (it->second->Spec.HasSameAttributes(spec)) return it->second;
+		}
+
+		auto *layout = new Layout { spec.Copy() };
+		glCreateVertexArrays(1, &layout->VAO);
+		SetupVertexArray_(layout->VAO, spec);
+		Layouts_.emplace(hash, layout);
+		Stats_.Layouts += 1;
+		return layout;
+	}
+
+	void OpenGL_VertexArrayCache::Bind(
+		OpenGL_StateCache &state, Layout *layout, uint32_t vertexBuffer, uint32_t indexBuffer
+	) {
+		if (layout->VertexBuffer != vertexBuffer) {
+			glVertexArrayVertexBuffer(layout->VAO, 0, vertexBuffer, 0, layout->Spec.PackedSize());
+			layout->VertexBuffer = vertexBuffer;
+			Stats_.Attached += 1;
+		} else {
+			Stats_.Skipped += 1;
+		}
+		if (layout->IndexBuffer != indexBuffer) {
+			glVertexArrayElementBuffer(layout->VAO, indexBuffer);
+			layout->IndexBuffer = indexBuffer;
+			Stats_.Attached += 1;
+		} else {
+			Stats_.Skipped += 1;
+		}
+		state.BindVertexArray(layout->VAO);
+	}
+
+	void OpenGL_VertexArrayCache::Destroy(OpenGL_StateCache &state) {
+		for (auto &[hash, layout] : Layouts_) {
+			state.OnVertexArrayDeleted(layout->VAO);
+			glDeleteVertexArrays(1, &layout->VAO);
+			delete layout;
+		}
+		Layouts_.clear();
+		Stats_ = {};
+	}
+
+	void OpenGL_MeshPool::Create_(OpenGL_VertexArrayCache &vaos) {
+		size_t stride = GetVertexSpec().PackedSize();
+		size_t indexSize = VertexAttribute::GetElementSize(GetVertexSpec().IndexType);
+
+		Layout = vaos.Acquire(GetVertexSpec());
+		glCreateBuffers(1, &VBO);
+		glCreateBuffers(1, &EBO);
+
+		glNamedBufferStorage(VBO, GetVertexCapacity() * stride, nullptr, GL_DYNAMIC_STORAGE_BIT);
+		glNamedBufferStorage(EBO, GetIndexCapacity() * indexSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+		Vertices_.Create(GetVertexCapacity());
+		Indices_.Create(GetIndexCapacity());
+	}
+
+	void OpenGL_MeshPool::Destroy_(OpenGL_DeletionQueue &deletions) {
+		Layout->Detach(VBO);
+		Layout->Detach(EBO);
+		deletions.ReleaseBuffer(EBO);
+		deletions.ReleaseBuffer(VBO);
+		deletions.ForgetPool(this);
+	}
+
+	bool OpenGL_MeshPool::Allocate_(size_t vertexCount, size_t indexCount, size_t &baseVertex, size_t &firstIndex) {
+		if (!Vertices_.Allocate(vertexCount, baseVertex)) return false;
+		if (!Indices_.Allocate(indexCount, firstIndex)) {
+			Vertices_.Free(baseVertex, vertexCount);
+			return false;
+		}
+		return true;
+	}
+
+	void OpenGL_MeshPool::Place_(
+		OpenGL_MeshMap &meshes, MeshHandle handle, size_t baseVertex, size_t firstIndex,
+		Span<uint8_t> vertexData, Span<uint8_t> indexData, const OpenGL_StagedMesh *staged
+	) {
+		auto *mesh = meshes.Get(handle);
+		size_t stride = GetVertexSpec().PackedSize();
+		size_t indexSize = VertexAttribute::GetElementSize(GetVertexSpec().IndexType);
+		if (staged) {
+			// Ordered before any draw issued after it, so the mesh is drawable
+			// right away; the staging region is reused only once the frame's
+			// fence has passed.
+			if (mesh->VertexCount) {
+				glCopyNamedBufferSubData(staged->Buffer, VBO, staged->VertexOffset, baseVertex * stride, mesh->VertexCount * stride);
+			}
+			if (mesh->IndexCount) {
+				glCopyNamedBufferSubData(staged->Buffer, EBO, staged->IndexOffset, firstIndex * indexSize, mesh->IndexCount * indexSize);
+			}
+		} else {
+			glNamedBufferSubData(VBO, baseVertex * stride, mesh->VertexCount * stride, vertexData.GetData());
+			if (mesh->IndexCount) {
+				glNamedBufferSubData(EBO, firstIndex * indexSize, mesh->IndexCount * indexSize, indexData.GetData());
+			}
+		}
+
+		mesh->Pool = this;
+		mesh->BaseVertex = baseVertex;
+		mesh->FirstIndex = firstIndex;
+		mesh->PoolSlot = Meshes_.GetCount();
+		Meshes_.Push(handle);
+	}
+
+	void OpenGL_MeshPool::Remove_(OpenGL_MeshMap &meshes, MeshHandle handle, OpenGL_DeletionQueue &deletions) {
+		auto *mesh = meshes.Get(handle);
+		deletions.ReleaseRange(this, mesh->BaseVertex, mesh->VertexCount, mesh->FirstIndex, mesh->IndexCount);
+
+		MeshHandle last = Meshes_[Meshes_.GetCount() - 1];
+		Meshes_[mesh->PoolSlot] = last;
+		meshes.Get(last)->PoolSlot = mesh->PoolSlot;
+		Meshes_.Resize(Meshes_.GetCount() - 1);
+	}
+
+	void OpenGL_MeshPool::Defragment_(OpenGL_MeshMap &meshes, OpenGL_DeletionQueue &deletions) {
+		if (Vertices_.IsCompact() && Indices_.IsCompact()) return;
+
+		size_t stride = GetVertexSpec().PackedSize();
+		size_t indexSize = VertexAttribute::GetElementSize(GetVertexSpec().IndexType);
+
+		// Copying within one buffer isn't allowed for overlapping ranges, so
+		// the meshes move into new buffers and the old ones are dropped.
+		GLuint buffers[2];
+		glCreateBuffers(2, buffers);
+		glNamedBufferStorage(buffers[0], GetVertexCapacity() * stride, nullptr, GL_DYNAMIC_STORAGE_BIT);
+		glNamedBufferStorage(buffers[1], GetIndexCapacity() * indexSize, nullptr, GL_DYNAMIC_STORAGE_BIT);
+
+		size_t vertexCursor = 0, indexCursor = 0;
+		for (auto handle : Meshes_) {
+			auto *mesh = meshes.Get(handle);
+			size_t vertexCount = mesh->VertexCount, indexCount = mesh->IndexCount;
+			if (vertexCount) {
+				glCopyNamedBufferSubData(VBO, buffers[0],
+					mesh->BaseVertex * stride, vertexCursor * stride, vertexCount * stride);
+			}
+			if (indexCount) {
+				glCopyNamedBufferSubData(EBO, buffers[1],
+					mesh->FirstIndex * indexSize, indexCursor * indexSize, indexCount * indexSize);
+			}
+			mesh->BaseVertex = vertexCursor;
+			mesh->FirstIndex = indexCursor;
+			vertexCursor += vertexCount;
+			indexCursor += indexCount;
+		}
+
+		// Ranges still waiting on the GPU were in the old buffers; the new ones
+		// only hold the live meshes.
+		size_t offset;
+		Vertices_.Create(GetVertexCapacity());
+		Vertices_.Allocate(vertexCursor, offset);
+		Indices_.Create(GetIndexCapacity());
+		Indices_.Allocate(indexCursor, offset);
+		deletions.ForgetPool(this);
+
+		Layout->Detach(VBO);
+		Layout->Detach(EBO);
+		deletions.ReleaseBuffer(VBO);
+		deletions.ReleaseBuffer(EBO);
+		VBO = buffers[0];
+		EBO = buffers[1];
+	}
+
+	OpenGL_MeshPool *OpenGL_MeshHeap::Allocate(
+		OpenGL_VertexArrayCache &vaos,
+		const VertexSpecification &spec,
+		size_t vertexCount, size_t indexCount,
+		size_t &baseVertex, size_t &firstIndex
+	) {
+		// Unindexed meshes take no indices, so they fit a block of any index type.
+		size_t largestVertices = 0, largestIndices = 0;
+		for (auto *block : Blocks_) {
+			const auto &blockSpec = block->GetVertexSpec();
+			if (!blockSpec.HasSameAttributes(spec)) continue;
+			if (indexCount && blockSpec.IndexType != spec.IndexType) continue;
+			if (block->Allocate_(vertexCount, indexCount, baseVertex, firstIndex)) return block;
+			largestVertices = std::max(largestVertices, block->GetVertexCapacity());
+			largestIndices = std::max(largestIndices, block->GetIndexCapacity());
+		}
+
+		// The first block of a layout is sized for the mesh that asks for it,
+		// and each one after that doubles, up to the full block size.
+		size_t stride = spec.PackedSize() ? spec.PackedSize() : 1;
+		size_t indexSize = VertexAttribute::GetElementSize(spec.IndexType);
+		auto capacity = [](size_t needed, size_t largest, size_t floor, size_t ceiling) {
+			size_t grown = std::min(std::max(largest * 2, floor), ceiling);
+			return std::max(needed, grown);
+		};
+		auto *block = new OpenGL_MeshPool(
+			spec,
+			capacity(vertexCount, largestVertices, MinVertexBlockSize / stride, VertexBlockSize / stride),
+			capacity(indexCount, largestIndices, MinIndexBlockSize / indexSize, IndexBlockSize / indexSize)
+		);
+		block->Create_(vaos);
+		Blocks_.Push(block);
+		if (block->Allocate_(vertexCount, indexCount, baseVertex, firstIndex)) return block;
+		return nullptr;
+	}
+
+	void OpenGL_MeshHeap::Defragment(OpenGL_DeletionQueue &deletions, OpenGL_MeshMap &meshes) {
+		size_t kept = 0;
+		for (auto *block : Blocks_) {
+			if (block->Meshes_.GetCount() == 0) {
+				block->Destroy_(deletions);
+				delete block;
+				continue;
+			}
+			block->Defragment_(meshes, deletions);
+			Blocks_[kept++] = block;
+		}
+		Blocks_.Resize(kept);
+	}
+
+	void OpenGL_MeshHeap::Destroy(OpenGL_DeletionQueue &deletions) {
+		for (auto *block : Blocks_) {
+			block->Destroy_(deletions);
+			delete block;
+		}
+		Blocks_.Clear();
+	}
+
+	void OpenGL_DeletionQueue::ReleaseBuffer(uint32_t buffer) {
+		Entries_.Push({ Kind_::Buffer, buffer, Frame_ });
+	}
+
+	void OpenGL_DeletionQueue::ReleaseProgram(uint32_t program) {
+		Entries_.Push({ Kind_::Program, program, Frame_ });
+	}
+
+	void OpenGL_DeletionQueue::ReleaseRange(
+		OpenGL_MeshPool *pool, size_t baseVertex, size_t vertexCount, size_t firstIndex, size_t indexCount
+	) {
+		Entries_.Push({ Kind_::Range, 0, Frame_, pool, baseVertex, vertexCount, firstIndex, indexCount });
+	}
+
+	void OpenGL_DeletionQueue::ForgetPool(OpenGL_MeshPool *pool) {
+		for (auto &entry : Entries_) {
+			if (entry.Kind == Kind_::Range && entry.Pool == pool) entry.Kind = Kind_::None;
+		}
+	}
+
+	void OpenGL_DeletionQueue::Retire(OpenGL_StateCache &state, uint64_t frame) {
+		size_t count = Entries_.GetCount(), retired = 0;
+		for (; retired < count; ++retired) {
+			auto &entry = Entries_[retired];
+			if (entry.Frame > frame) break;
+			switch (entry.Kind) {
+			case Kind_::None: break;
+			case Kind_::Buffer:
+				state.OnBufferDeleted(entry.Name);
+				glDeleteBuffers(1, &entry.Name);
+				break;
+			case Kind_::Program:
+				state.OnProgramDeleted(entry.Name);
+				glDeleteProgram(entry.Name);
+				break;
+			case Kind_::Range:
+				entry.Pool->Vertices_.Free(entry.BaseVertex, entry.VertexCount);
+				entry.Pool->Indices_.Free(entry.FirstIndex, entry.IndexCount);
+				break;
+			}
+		}
+		if (retired == 0) return;
+		for (size_t i = retired; i < count; ++i) Entries_[i - retired] = Entries_[i];
+		Entries_.Resize(count - retired);
+	}
+
+	OpenGL_MeshHeap::Stats OpenGL_MeshHeap::GetStats() const {
+		Stats stats;
+		size_t vertexFree = 0, vertexLargest = 0, indexFree = 0, indexLargest = 0;
+		for (const auto *block : Blocks_) {
+			size_t stride = block->GetVertexSpec().PackedSize();
+			size_t indexSize = VertexAttribute::GetElementSize(block->GetVertexSpec().IndexType);
+			const auto &vertices = block->Vertices_, &indices = block->Indices_;
 
-		glNamedBufferStorage(VBO, vertexData.GetByteSize(), vertexData.GetData(), 0);
-		if (IsIndexed()) glNamedBufferStorage(EBO, indexData.GetByteSize(), indexData.GetData(), 0);
+			stats.Blocks += 1;
+			stats.Meshes += block->Meshes_.GetCount();
+			stats.VertexBytes += vertices.GetCapacity() * stride;
+			stats.VertexBytesUsed += (vertices.GetCapacity() - vertices.GetFreeSize()) * stride;
+			stats.IndexBytes += indices.GetCapacity() * indexSize;
+			stats.IndexBytesUsed += (indices.GetCapacity() - indices.GetFreeSize()) * indexSize;
+			stats.Holes += vertices.GetFreeRangeCount() - (vertices.IsCompact() && vertices.GetFreeRangeCount() ? 1 : 0);
+			stats.Holes += indices.GetFreeRangeCount() - (indices.IsCompact() && indices.GetFreeRangeCount() ? 1 : 0);
+
+			vertexFree += vertices.GetFreeSize() * stride;
+			indexFree += indices.GetFreeSize() * indexSize;
+			size_t largest = vertices.GetLargestFree() * stride;
+			vertexLargest = largest > vertexLargest ? largest : vertexLargest;
+			largest = indices.GetLargestFree() * indexSize;
+			indexLargest = largest > indexLargest ? largest : indexLargest;
+		}
+		if (vertexFree) stats.VertexFragmentation = 1.0f - vertexLargest / (float)vertexFree;
+		if (indexFree) stats.IndexFragmentation = 1.0f - indexLargest / (float)indexFree;
+		return stats;
 	}
 
-	void OpenGL_Mesh::Destroy_() {
-		if (IsIndexed()) glDeleteBuffers(1, &EBO);
-		glDeleteBuffers(1, &VBO);
-		glDeleteVertexArrays(1, &VAO);
+	static GLenum BufferTargetToGLenum_(OpenGL_StateCache::BufferTarget target) {
+		switch (target) {
+			case OpenGL_StateCache::BufferTarget::Array: return GL_ARRAY_BUFFER;
+			case OpenGL_StateCache::BufferTarget::DrawIndirect: return GL_DRAW_INDIRECT_BUFFER;
+			case OpenGL_StateCache::BufferTarget::Uniform: return GL_UNIFORM_BUFFER;
+			case OpenGL_StateCache::BufferTarget::CopyRead: return GL_COPY_READ_BUFFER;
+			case OpenGL_StateCache::BufferTarget::CopyWrite: return GL_COPY_WRITE_BUFFER;
+			default: return GL_NONE;
+		}
+	}
+
+	void OpenGL_StateCache::UseProgram(uint32_t program) {
+		if (Program_ == program) { Stats_.Skipped += 1; return; }
+		glUseProgram(program);
+		Program_ = program;
+		Stats_.Issued += 1;
+	}
+
+	void OpenGL_StateCache::BindVertexArray(uint32_t vao) {
+		if (VertexArray_ == vao) { Stats_.Skipped += 1; return; }
+		glBindVertexArray(vao);
+		VertexArray_ = vao;
+		Stats_.Issued += 1;
+	}
+
+	void OpenGL_StateCache::BindBuffer(BufferTarget target, uint32_t buffer) {
+		auto &bound = Buffers_[(size_t)target];
+		if (bound == buffer) { Stats_.Skipped += 1; return; }
+		glBindBuffer(BufferTargetToGLenum_(target), buffer);
+		bound = buffer;
+		Stats_.Issued += 1;
+	}
+
+	void OpenGL_StateCache::BindUniformBufferRange(uint32_t index, uint32_t buffer, size_t offset, size_t size) {
+		if (index >= MaxUniformBindings) {
+			glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+			Buffers_[(size_t)BufferTarget::Uniform] = buffer;
+			Stats_.Issued += 1;
+			return;
+		}
+		auto &bound = UniformRanges_[index];
+		if (bound.Buffer == buffer && bound.Offset == offset && bound.Size == size) {
+			Stats_.Skipped += 1;
+			return;
+		}
+		glBindBufferRange(GL_UNIFORM_BUFFER, index, buffer, offset, size);
+		bound = { buffer, offset, size };
+		// Binding a range also binds the generic uniform buffer target.
+		Buffers_[(size_t)BufferTarget::Uniform] = buffer;
+		Stats_.Issued += 1;
+	}
+
+	void OpenGL_StateCache::ClearColor(float r, float g, float b, float a) {
+		if (ClearColor_[0] == r && ClearColor_[1] == g && ClearColor_[2] == b && ClearColor_[3] == a) {
+			Stats_.Skipped += 1;
+			return;
+		}
+		glClearColor(r, g, b, a);
+		ClearColor_[0] = r; ClearColor_[1] = g; ClearColor_[2] = b; ClearColor_[3] = a;
+		Stats_.Issued += 1;
+	}
+
+	void OpenGL_StateCache::Invalidate() {
+		Program_ = Unknown_;
+		VertexArray_ = Unknown_;
+		for (auto &buffer : Buffers_) buffer = Unknown_;
+		for (auto &range : UniformRanges_) range = { Unknown_, 0, 0 };
+		// NaN never compares equal, so the next clear color always goes through.
+		for (auto &c : ClearColor_) c = __builtin_nanf("");
+	}
+
+	void OpenGL_StateCache::OnProgramDeleted(uint32_t program) {
+		if (Program_ == program) Program_ = Unknown_;
+	}
+
+	void OpenGL_StateCache::OnVertexArrayDeleted(uint32_t vao) {
+		// GL reverts to the default vertex array when the bound one is deleted.
+		if (VertexArray_ == vao) VertexArray_ = 0;
+	}
+
+	void OpenGL_StateCache::OnBufferDeleted(uint32_t buffer) {
+		for (auto &bound : Buffers_) {
+			if (bound == buffer) bound = 0;
+		}
+		for (auto &range : UniformRanges_) {
+			if (range.Buffer == buffer) range = { 0, 0, 0 };
+		}
+	}
+
+	void OpenGL_StreamBuffer::Create(size_t regionSize) {
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		RegionSize_ = regionSize;
+		glCreateBuffers(1, &Buffer_);
+		glNamedBufferStorage(Buffer_, RegionSize_ * Renderer::FramesInFlight, nullptr, flags);
+		Mapped_ = (uint8_t*)glMapNamedBufferRange(Buffer_, 0, RegionSize_ * Renderer::FramesInFlight, flags);
+		Slot_ = 0;
+		Cursor_ = 0;
+	}
+
+	void OpenGL_StreamBuffer::Destroy() {
+		if (!Buffer_) return;
+		glUnmapNamedBuffer(Buffer_);
+		glDeleteBuffers(1, &Buffer_);
+		Buffer_ = 0;
+		Mapped_ = nullptr;
+	}
+
+	void OpenGL_StreamBuffer::BeginFrame(size_t slot) {
+		Slot_ = slot;
+		Cursor_.store(0, std::memory_order_relaxed);
+	}
+
+	OpenGL_StreamBuffer::Allocation OpenGL_StreamBuffer::Allocate(size_t size, size_t alignment) {
+		if (!Mapped_) return { nullptr, 0 };
+		size_t base = Slot_ * RegionSize_;
+		size_t cursor = Cursor_.load(std::memory_order_relaxed);
+		size_t offset;
+		do {
+			// Aligned relative to the whole buffer, as offsets handed to GL are.
+			offset = base + cursor;
+			if (alignment > 1) offset = (offset + alignment - 1) / alignment * alignment;
+			if (offset + size > base + RegionSize_) return { nullptr, 0 };
+		} while (!Cursor_.compare_exchange_weak(cursor, offset + size - base, std::memory_order_relaxed));
+		return { Mapped_ + offset, offset };
+	}
+
+	void OpenGL_UniformRing::Create(size_t regionSize) {
+		GLint alignment = 0;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		if (alignment > 0) Alignment_ = alignment;
+		Stream_.Create(regionSize);
+	}
+
+	UniformArena::Allocation OpenGL_UniformRing::Allocate(size_t size) {
+		auto alloc = Stream_.Allocate(size, Alignment_);
+		return { alloc.Ptr, (uint32_t)alloc.Offset };
+	}
+
+	void OpenGL_GpuProfiler::Create() {
+		for (auto &frame : Frames_) {
+			glGenQueries(MaxQueriesPerFrame, frame.Queries);
+			frame.UsedQueries = 0;
+			frame.Scopes.Clear();
+		}
+		Open_.Clear();
+		Created_ = true;
+	}
+
+	void OpenGL_GpuProfiler::Destroy() {
+		if (!Created_) return;
+		for (auto &frame : Frames_) {
+			glDeleteQueries(MaxQueriesPerFrame, frame.Queries);
+			frame.UsedQueries = 0;
+			frame.Scopes.Clear();
+		}
+		Open_.Clear();
+		Created_ = false;
+	}
+
+	void OpenGL_GpuProfiler::BeginFrame(size_t slot) {
+		if (!Created_) return;
+		Frame_ &frame = Frames_[slot];
+		for (const Scope_ &scope : frame.Scopes) {
+			// A scope left open by the recorded frame has no end time.
+			if (!scope.Closed) continue;
+			// The frame's fence has passed, so this should always be ready;
+			// drop the sample rather than wait if a driver says otherwise.
+			GLint available = 0;
+			glGetQueryObjectiv(frame.Queries[scope.End], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) continue;
+			GLuint64 begin, end;
+			glGetQueryObjectui64v(frame.Queries[scope.Begin], GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(frame.Queries[scope.End], GL_QUERY_RESULT, &end);
+			Record_(scope.Id, end > begin ? (end - begin) / 1e6 : 0.0);
+		}
+		frame.UsedQueries = 0;
+		frame.Scopes.Clear();
+		Open_.Clear();
+		Slot_ = slot;
+		InFrame_ = true;
+	}
+
+	void OpenGL_GpuProfiler::EndFrame() {
+		// Scopes still open are left untimed, as their end would land after
+		// the fence that BeginFrame relies on.
+		Open_.Clear();
+		InFrame_ = false;
+	}
+
+	void OpenGL_GpuProfiler::Begin(MarkerId id) {
+		Frame_ &frame = Frames_[Slot_];
+		// Both timestamps are reserved up front so nested scopes can't run
+		// out of queries between a begin and its end.
+		if (!Enabled_ || !Created_ || !InFrame_ || frame.UsedQueries + 2 > MaxQueriesPerFrame) {
+			Open_.Push(Untimed_);
+			return;
+		}
+		uint32_t begin = frame.UsedQueries;
+		frame.UsedQueries += 2;
+		glQueryCounter(frame.Queries[begin], GL_TIMESTAMP);
+		frame.Scopes.Push({ id, begin, begin + 1, false });
+		Open_.Push(frame.Scopes.GetCount() - 1);
+	}
+
+	void OpenGL_GpuProfiler::End() {
+		if (Open_.GetCount() == 0) return;
+		size_t index = Open_[Open_.GetCount() - 1];
+		Open_.Resize(Open_.GetCount() - 1);
+		if (index == Untimed_) return;
+		Frame_ &frame = Frames_[Slot_];
+		Scope_ &scope = frame.Scopes[index];
+		glQueryCounter(frame.Queries[scope.End], GL_TIMESTAMP);
+		scope.Closed = true;
+	}
+
+	void OpenGL_GpuProfiler::Record_(MarkerId id, double ms) {
+		size_t count = Histories_.GetCount();
+		if (id.GetValue() >= count) {
+			Histories_.Resize(id.GetValue() + 1);
+			for (size_t i = count; i < Histories_.GetCount(); ++i) {
+				Histories_[i].Count = 0;
+				Histories_[i].Next = 0;
+			}
+		}
+		History_ &history = Histories_[id.GetValue()];
+		history.Id = id;
+		history.Samples[history.Next] = ms;
+		history.Next = (history.Next + 1) % HistorySize;
+		if (history.Count < HistorySize) ++history.Count;
+		history.Last = ms;
+	}
+
+	void OpenGL_GpuProfiler::GetStats(GrowingSpan<MarkerStats> &out) const {
+		out.Clear();
+		double sorted[HistorySize];
+		for (const History_ &history : Histories_) {
+			if (history.Count == 0) continue;
+			double sum = 0.0;
+			for (size_t i = 0; i < history.Count; ++i) {
+				sorted[i] = history.Samples[i];
+				sum += sorted[i];
+			}
+			std::sort(sorted, sorted + history.Count);
+			size_t p99 = (history.Count * 99 + 99) / 100;
+			out.Push({
+				history.Id,
+				history.Count,
+				sorted[0],
+				sum / history.Count,
+				sorted[p99 - 1],
+				history.Last
+			});
+		}
+	}
+
+	bool OpenGL_GpuProfiler::WriteCSV(const char *filename) const {
+		FILE *file = fopen(filename, "w");
+		if (!file) {
+			fmt::print(stderr, "Failed to open {} for writing\n", filename);
+			return false;
+		}
+		GrowingSpan<MarkerStats> stats;
+		GetStats(stats);
+		fmt::print(file, "marker,samples,min_ms,avg_ms,p99_ms,last_ms\n");
+		for (const MarkerStats &s : stats) {
+			fmt::print(file, "{},{},{:.4f},{:.4f},{:.4f},{:.4f}\n",
+				s.Id.GetName(), s.Samples, s.MinMs, s.AvgMs, s.P99Ms, s.LastMs);
+		}
+		fclose(file);
+		return true;
 	}
 
 	void OpenGL_Renderer::Initialize() {
 		// glEnable(GL_DEPTH_TEST);
+		State_.Invalidate();
+		Stream_.Create(StreamSize);
+		UniformRing_.Create(UniformRingSize);
+		Profiler_.Create();
+		ProgramCache_.Initialize(ProgramCacheDirectory_);
+
+		GLint extensionCount = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+		for (GLint i = 0; i < extensionCount; ++i) {
+			auto *name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (strcmp(name, "GL_KHR_parallel_shader_compile") == 0) {
+				ParallelShaderCompile_ = true;
+				// The default is implementation defined, and some drivers pick 0.
+				glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+				break;
+			}
+		}
 	}
 
 	void OpenGL_Renderer::DeInitialize() {
+		for (size_t slot = 0; slot < FramesInFlight; ++slot) {
+			WaitForFrame_(slot);
+		}
+		State_.OnBufferDeleted(Stream_.GetBuffer());
+		State_.OnBufferDeleted(UniformRing_.GetBuffer());
+		State_.OnBufferDeleted(Staging_.GetBuffer());
+		Stream_.Destroy();
+		Staging_.Destroy();
+		StagingSize_ = 0;
+		UniformRing_.Destroy();
+		MeshHeap_.Destroy(Deletions_);
+		Deletions_.RetireAll(State_);
+		VertexArrays_.Destroy(State_);
+		Profiler_.Destroy();
+	}
+
+	void OpenGL_Renderer::WaitForFrame_(size_t slot) {
+		GLsync fence = FrameFences_[slot];
+		if (fence) {
+			while (true) {
+				GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1'000'000'000);
+				if (result != GL_TIMEOUT_EXPIRED) break;
+			}
+			glDeleteSync(fence);
+			FrameFences_[slot] = nullptr;
+			Deletions_.Retire(State_, SubmittedFrames_[slot]);
+		}
+	}
+
+	UniformArena *OpenGL_Renderer::BeginUniformArena_(size_t slot) {
+		UniformRing_.BeginFrame(slot);
+		return &UniformRing_;
+	}
 
+	void OpenGL_Renderer::BeginSubmit_(size_t slot) {
+		// These belong to submission, which may lag behind recording.
+		Stream_.BeginFrame(slot);
+		Staging_.BeginFrame(slot);
+		Profiler_.BeginFrame(slot);
+		SubmitSlot_ = slot;
+		Submitting_ = true;
+	}
+
+	void OpenGL_Renderer::SignalFrame_(size_t slot, uint64_t frame) {
+		Submitting_ = false;
+		Profiler_.EndFrame();
+		FrameFences_[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		SubmittedFrames_[slot] = frame;
+		Deletions_.SetFrame(frame + 1);
 	}
 	
+	void OpenGL_Renderer::ReserveUploadStaging_(size_t bytesPerFrame) {
+		if (bytesPerFrame <= StagingSize_) return;
+		// Copies still reading the old ring keep it alive; GL defers the
+		// deletion until they are done.
+		State_.OnBufferDeleted(Staging_.GetBuffer());
+		Staging_.Destroy();
+		Staging_.Create(bytesPerFrame);
+		Staging_.BeginFrame(SubmitSlot_);
+		StagingSize_ = bytesPerFrame;
+	}
+
+	Owned<Mesh> OpenGL_Renderer::UploadMesh_(
+		Span<uint8_t> vertexData,
+		Span<uint8_t> indexData,
+		bool indexed,
+		const VertexSpecification &spec
+	) {
+		// One allocation per mesh, with the indices 4-byte aligned after the vertices.
+		size_t indexOffset = (vertexData.GetByteSize() + 3) & ~(size_t)3;
+		auto alloc = Staging_.Allocate(indexOffset + indexData.GetByteSize(), 4);
+		if (!alloc.Ptr) return AddMesh_(nullptr, indexed, vertexData, indexData, spec);
+
+		CopyItems(alloc.Ptr, vertexData.GetData(), vertexData.GetByteSize());
+		if (indexData.GetByteSize()) CopyItems(alloc.Ptr + indexOffset, indexData.GetData(), indexData.GetByteSize());
+		OpenGL_StagedMesh staged { Staging_.GetBuffer(), alloc.Offset, alloc.Offset + indexOffset };
+		return AddMesh_(nullptr, indexed, vertexData, indexData, spec, &staged);
+	}
+
+	Owned<Mesh> OpenGL_Renderer::AddMesh_(
+		OpenGL_MeshPool *pool, bool indexed,
+		Span<uint8_t> vertexData, Span<uint8_t> indexData,
+		const VertexSpecification &spec,
+		const OpenGL_StagedMesh *staged
+	) {
+		size_t vertexCount = vertexData.GetByteSize() / spec.PackedSize();
+		size_t indexSize = VertexAttribute::GetElementSize(spec.IndexType);
+		size_t indexCount = indexData.GetByteSize() / indexSize;
+
+		size_t baseVertex, firstIndex;
+		if (pool) {
+			if (!pool->Allocate_(vertexCount, indexCount, baseVertex, firstIndex)) return {};
+		} else {
+			pool = MeshHeap_.Allocate(VertexArrays_, spec, vertexCount, indexCount, baseVertex, firstIndex);
+			if (!pool) return {};
+		}
+
+		auto handle = Meshes_.Insert({
+			nullptr, 0, 0,
+			(uint32_t)vertexCount, (uint32_t)indexCount,
+			indexed ? DataTypeToGLenum_(spec.IndexType) : 0, (uint32_t)indexSize,
+			(uint32_t)spec.InstancePackedSize(), 0
+		});
+		if (!handle.IsValid()) {
+			pool->Vertices_.Free(baseVertex, vertexCount);
+			pool->Indices_.Free(firstIndex, indexCount);
+			return {};
+		}
+		pool->Place_(Meshes_, handle, baseVertex, firstIndex, vertexData, indexData, staged);
+		return Owned<Mesh>(new Mesh(handle, indexed, vertexCount, indexCount, spec));
+	}
+
 	Owned<Mesh> OpenGL_Renderer::CreateMesh(
 		Span<uint8_t> vertexData,
 		Span<uint8_t> indexData,
 		const VertexSpecification &spec
 	) {
-		auto *m = new OpenGL_Mesh(
-			true,
-			vertexData.GetByteSize() / spec.PackedSize(),
-			indexData.GetByteSize(),
-			spec
-		);
-		m->Create_(vertexData, indexData);
-		return Owned<Mesh>(m);
+		return AddMesh_(nullptr, true, vertexData, indexData, spec);
 	}
 
 	Owned<Mesh> OpenGL_Renderer::CreateMesh(
 		Span<uint8_t> vertexData,
 		const VertexSpecification &spec
 	) {
-		auto *m = new OpenGL_Mesh(
-			false,
-			vertexData.GetByteSize() / spec.PackedSize(),
-			0,
-			spec
-		);
-		m->Create_(vertexData, { nullptr, 0 });
-		return Owned<Mesh>(m);
+		return AddMesh_(nullptr, false, vertexData, { nullptr, 0 }, spec);
+	}
+
+	Owned<MeshPool> OpenGL_Renderer::CreateMeshPool(
+		const VertexSpecification &spec,
+		size_t vertexCapacity,
+		size_t indexCapacity
+	) {
+		auto *pool = new OpenGL_MeshPool(spec, vertexCapacity, indexCapacity);
+		pool->Create_(VertexArrays_);
+		return Owned<MeshPool>(pool);
+	}
+
+	Owned<Mesh> OpenGL_Renderer::CreateMesh(
+		Ref<MeshPool> pool_,
+		Span<uint8_t> vertexData,
+		Span<uint8_t> indexData
+	) {
+		auto *pool = (OpenGL_MeshPool*)pool_.Get();
+		return AddMesh_(pool, true, vertexData, indexData, pool->GetVertexSpec());
 	}
 
 	Owned<Shader> OpenGL_Renderer::CreateShader(const char *vertexSource, const char *fragmentSource) {
-		auto *shader = new OpenGL_Shader();
-		shader->Create_(vertexSource, fragmentSource);
+		auto handle = Shaders_.Insert({});
+		if (!handle.IsValid()) return {};
+		auto *shader = new OpenGL_Shader(handle);
+		shader->Create_(vertexSource, fragmentSource, ProgramCache_);
+		if (shader->Status == ShaderStatus::Compiling) {
+			// Without the extension the driver compiles on this thread anyway.
+			if (ParallelShaderCompile_) PendingShaders_.Push(shader);
+			else shader->Poll_(ProgramCache_, true);
+		}
+		*Shaders_.Get(handle) = { shader, shader->Id, shader->Status == ShaderStatus::Ready };
 		return Owned<Shader>(shader);
 	}
 
+	ShaderStatus OpenGL_Renderer::GetShaderStatus(Ref<Shader> shader) {
+		auto *s = (OpenGL_Shader*)shader.Get();
+		if (s->Status == ShaderStatus::Compiling) PollShaders_();
+		return s->Status;
+	}
+
+	bool OpenGL_Renderer::CheckVertexInputs(const Shader *shader, const VertexSpecification &spec, Span<char> reason) const {
+		auto *s = (const OpenGL_Shader*)shader;
+		if (s->Status.load(std::memory_order_acquire) != ShaderStatus::Ready) return true;
+
+		char *out = reason.GetData();
+		size_t limit = reason.GetCount() - 1;
+		auto fail = [](auto result) {
+			*result.out = '\0';
+			return false;
+		};
+
+		size_t attributeCount = spec.Attributes.GetCount();
+		for (const auto &input : s->GetVertexInputs()) {
+			for (GLint location = input.Location; location < input.Location + input.Locations; ++location) {
+				if ((size_t)location >= attributeCount) {
+					return fail(fmt::format_to_n(out, limit, "program reads location {}, but the mesh has {} attributes", location, attributeCount));
+				}
+				const auto &attribute = spec.Attributes[location];
+				DataType type = attribute.Type;
+				// Integer attributes go through glVertexArrayAttribIFormat unless
+				// normalized, and then only reach integer inputs.
+				bool integerInput = input.ComponentType == DataType::Int32 || input.ComponentType == DataType::UInt32;
+				if (integerInput && !attribute.IsInteger()) {
+					return fail(fmt::format_to_n(out, limit, "location {} is an integer input, but the attribute is {}{}", location,
+						attribute.Normalized ? "normalized " : "", DataTypeToString(type)));
+				}
+				if (!integerInput && attribute.IsInteger()) {
+					return fail(fmt::format_to_n(out, limit, "location {} is a float input, but the attribute is {} and not normalized", location, DataTypeToString(type)));
+				}
+				if (input.ComponentType == DataType::Float64 && type != DataType::Float64) {
+					return fail(fmt::format_to_n(out, limit, "location {} is a double input, but the attribute is {}", location, DataTypeToString(type)));
+				}
+			}
+		}
+		return true;
+	}
+
+	const char *OpenGL_Renderer::GetShaderLog(Ref<Shader> shader) const {
+		return ((const OpenGL_Shader*)shader.Get())->GetLog();
+	}
+
+	void OpenGL_Renderer::PollShaders_() {
+		size_t kept = 0;
+		for (auto *shader : PendingShaders_) {
+			shader->Poll_(ProgramCache_, false);
+			if (shader->Status == ShaderStatus::Compiling) {
+				PendingShaders_[kept++] = shader;
+			} else {
+				Shaders_.Get(shader->GetHandle())->Ready = shader->Status == ShaderStatus::Ready;
+			}
+		}
+		PendingShaders_.Resize(kept);
+	}
+
 	void OpenGL_Renderer::DestroyMesh(Owned<Mesh> &&mesh) {
-		((OpenGL_Mesh*)mesh.Get())->Destroy_();
+		auto handle = mesh->GetHandle();
+		auto *record = Meshes_.Get(handle);
+		if (!record) return;
+		record->Pool->Remove_(Meshes_, handle, Deletions_);
+		Meshes_.Remove(handle);
+		RetireIfIdle_();
+	}
+
+	void OpenGL_Renderer::DestroyMeshPool(Owned<MeshPool> &&pool) {
+		auto *p = (OpenGL_MeshPool*)pool.Get();
+		p->Destroy_(Deletions_);
+		RetireIfIdle_();
 	}
 
 	void OpenGL_Renderer::DestroyShader(Owned<Shader> &&shader) {
-		((OpenGL_Shader*)shader.Get())->Destroy_();
+		auto *s = (OpenGL_Shader*)shader.Get();
+		for (size_t i = 0; i < PendingShaders_.GetCount(); ++i) {
+			if (PendingShaders_[i] != s) continue;
+			PendingShaders_[i] = PendingShaders_[PendingShaders_.GetCount() - 1];
+			PendingShaders_.Resize(PendingShaders_.GetCount() - 1);
+			break;
+		}
+		s->Destroy_(Deletions_);
+		Shaders_.Remove(s->GetHandle());
+		RetireIfIdle_();
+	}
+
+	void OpenGL_Renderer::RetireIfIdle_() {
+		// Commands issued so far this frame aren't fenced yet.
+		if (Submitting_) return;
+		for (auto *fence : FrameFences_) {
+			if (!fence) continue;
+			GLenum result = glClientWaitSync(fence, 0, 0);
+			if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED) return;
+		}
+		Deletions_.RetireAll(State_);
+	}
+
+	static void DrawMesh_(
+		OpenGL_StateCache &state, OpenGL_VertexArrayCache &vaos,
+		const OpenGL_MeshRecord &mesh, const OpenGL_ShaderRecord &shader
+	);
+	static void DrawMeshInstanced_(
+		OpenGL_StateCache &state, OpenGL_VertexArrayCache &vaos, OpenGL_StreamBuffer &stream,
+		const OpenGL_MeshRecord &mesh, const InstancedDrawData &data, const OpenGL_ShaderRecord &shader
+	);
+	/// Returns how many of the meshes had been destroyed and were skipped.
+	static size_t DrawMeshes_(
+		OpenGL_StateCache &state, OpenGL_VertexArrayCache &vaos, OpenGL_StreamBuffer &stream,
+		const OpenGL_MeshMap &meshes, Span<const MeshHandle> handles, const OpenGL_ShaderRecord &shader
+	);
+	static void Clear_(OpenGL_StateCache &state, float r, float g, float b, float a);
+	static void SetUniform_(const UniformData &data, const OpenGL_ShaderRecord &boundShader);
+	static void BindUniformBlock_(
+		OpenGL_StateCache &state, OpenGL_UniformRing &ring, OpenGL_StreamBuffer &stream, const UniformBlockData &data
+	);
+
+	/// Decodes the payload of a command whose type was just read. Returns false
+	/// for command types that can't be decoded.
+	static bool DecodeCommand_(CommandBufferReader &reader, CommandType type, OpenGL_Command_ &cmd) {
+		cmd.Type = type;
+		switch (type) {
+		case CommandType::DrawMesh: cmd.DrawnMesh = reader.ReadCmdDrawMesh(); return true;
+		case CommandType::DrawMeshInstanced: cmd.Instanced = reader.ReadCmdDrawMeshInstanced(); return true;
+		case CommandType::DrawMeshes: cmd.Meshes = reader.ReadCmdDrawMeshes(); return true;
+		case CommandType::BindShader: cmd.BoundShader = reader.ReadCmdBindShader(); return true;
+		case CommandType::ExecuteBundle: cmd.ExecutedBundle = reader.ReadCmdExecuteBundle(); return true;
+		case CommandType::Uniform: cmd.Uniform = reader.ReadCmdUniform(); return true;
+		case CommandType::UniformBlock: cmd.Block = reader.ReadCmdUniformBlock(); return true;
+		case CommandType::Clear: cmd.Color = reader.ReadCmdClear(); return true;
+		case CommandType::BeginMarker: cmd.Marker = reader.ReadCmdBeginMarker(); return true;
+		case CommandType::EndMarker: reader.ReadCmdEndMarker(); return true;
+		case CommandType::End: return true;
+		}
+		return false;
+	}
+
+	struct OpenGL_Executor_ {
+		OpenGL_StateCache &State;
+		OpenGL_VertexArrayCache &VertexArrays;
+		OpenGL_StreamBuffer &Stream;
+		OpenGL_UniformRing &UniformRing;
+		OpenGL_GpuProfiler &Profiler;
+		const OpenGL_MeshMap &Meshes;
+		const SlotMap<Shader, OpenGL_ShaderRecord> &Shaders;
+		/// Null if the bound program isn't ready, which skips the draws.
+		const OpenGL_ShaderRecord *BoundShader = nullptr;
+		size_t SkippedDraws = 0;
+	};
+
+	static void Execute_(OpenGL_Executor_ &executor, const OpenGL_Command_ &cmd) {
+		auto &state = executor.State;
+		auto &vaos = executor.VertexArrays;
+		auto &stream = executor.Stream;
+		switch (cmd.Type) {
+		case CommandType::DrawMesh: {
+			const auto *mesh = executor.Meshes.Get(cmd.DrawnMesh);
+			if (!executor.BoundShader || !mesh) { executor.SkippedDraws += 1; break; }
+			DrawMesh_(state, vaos, *mesh, *executor.BoundShader);
+			break;
+		}
+		case CommandType::DrawMeshInstanced: {
+			const auto *mesh = executor.Meshes.Get(cmd.Instanced.DrawnMesh);
+			if (!executor.BoundShader || !mesh) { executor.SkippedDraws += 1; break; }
+			DrawMeshInstanced_(state, vaos, stream, *mesh, cmd.Instanced, *executor.BoundShader);
+			break;
+		}
+		case CommandType::DrawMeshes:
+			if (!executor.BoundShader) { executor.SkippedDraws += cmd.Meshes.GetCount(); break; }
+			executor.SkippedDraws += DrawMeshes_(state, vaos, stream, executor.Meshes, cmd.Meshes, *executor.BoundShader);
+			break;
+		case CommandType::BindShader: {
+			const auto *shader = executor.Shaders.Get(cmd.BoundShader);
+			executor.BoundShader = shader && shader->Ready ? shader : nullptr;
+			break;
+		}
+		case CommandType::ExecuteBundle:
+			for (const auto &bundled : ((OpenGL_Bundle*)cmd.ExecutedBundle)->Commands) {
+				Execute_(executor, bundled);
+			}
+			break;
+		case CommandType::Uniform:
+			if (executor.BoundShader) SetUniform_(cmd.Uniform, *executor.BoundShader);
+			break;
+		case CommandType::UniformBlock:
+			BindUniformBlock_(state, executor.UniformRing, executor.Stream, cmd.Block);
+			break;
+		case CommandType::Clear:
+			Clear_(state, cmd.Color.r, cmd.Color.g, cmd.Color.b, cmd.Color.a);
+			break;
+		case CommandType::BeginMarker:
+			executor.Profiler.Begin(cmd.Marker);
+			break;
+		case CommandType::EndMarker:
+			executor.Profiler.End();
+			break;
+		case CommandType::End: break;
+		}
+	}
+
+	void OpenGL_Renderer::FlushCommandBuffers(Span<const Ref<CommandBuffer>> cmdBufs) {
+		State_.ResetStats();
+		if (PendingShaders_.GetCount()) PollShaders_();
+		// Only EndFrame recycles the stream, so a flush of its own waits for
+		// the last user of the region and starts it over, then fences it
+		// like a frame for the next one.
+		bool standalone = !Submitting_;
+		if (standalone) {
+			WaitForFrame_(SubmitSlot_);
+			Stream_.BeginFrame(SubmitSlot_);
+		}
+		OpenGL_Executor_ executor { State_, VertexArrays_, Stream_, UniformRing_, Profiler_, Meshes_, Shaders_ };
+		for (const auto &cmdBuf : cmdBufs) {
+			if (cmdBuf->GetCount() == 0) continue;
+			CommandBufferReader reader(cmdBuf->GetData(), cmdBuf->GetArena());
+			OpenGL_Command_ cmd;
+			while (true) {
+				auto type = reader.ReadType();
+				if (type == CommandType::End) break;
+				if (!DecodeCommand_(reader, type, cmd)) {
+					fmt::print(stderr, "Unknown command {:#x} in command buffer\n", (int)type);
+					break;
+				}
+				Execute_(executor, cmd);
+			}
+		}
+		SkippedDraws_ = executor.SkippedDraws;
+		if (standalone) FrameFences_[SubmitSlot_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
 	}
 
-	static void DrawMesh_(Ref<Mesh> mesh_, Ref<Shader> shader_);
-	static void Clear_(float r, float g, float b, float a);
-	static void SetUniform_(const UniformData &data, OpenGL_Shader *boundShader);
+	Owned<Bundle> OpenGL_Renderer::CreateBundle(Ref<CommandBuffer> cmdBuf) {
+		auto recorded = cmdBuf->GetData();
+		auto *bundle = new OpenGL_Bundle(cmdBuf->GetCount());
+		auto arena = cmdBuf->GetArena();
+		CopyItems(bundle->Data.Extend(recorded.GetCount()), recorded.GetData(), recorded.GetCount());
+		CopyItems(bundle->Arena.Extend(arena.GetCount()), arena.GetData(), arena.GetCount());
 
-	void OpenGL_Renderer::FlushCommandBuffer(Ref<CommandBuffer> cmdBuf) {
-		CommandBufferReader reader(cmdBuf->GetData());
-		OpenGL_Shader *boundShader = nullptr;
+		// Checked before decoding, which trusts the payloads.
+		if (!ValidateBundleData(bundle->Data, bundle->Arena)) {
+			delete bundle;
+			return {};
+		}
+		CommandBufferReader reader(bundle->Data, bundle->Arena);
 		while (true) {
 			auto type = reader.ReadType();
 			if (type == CommandType::End) break;
+			DecodeCommand_(reader, type, *bundle->Commands.Extend(1));
+		}
+
+		return Owned<Bundle>(bundle);
+	}
+
+	void OpenGL_Renderer::DestroyBundle(Owned<Bundle> &&bundle) {
+		// Bundles hold no GL objects, only CPU memory released with the Owned.
+	}
 
-			switch (type) {
-			case CommandType::DrawMesh: {
-				auto *mesh = (OpenGL_Mesh*)reader.ReadCmdDrawMesh();
-				DrawMesh_(mesh, boundShader);
-			} break;
-			case CommandType::BindShader: {
-				boundShader = (OpenGL_Shader*)reader.ReadCmdBindShader();
-			} break;
-			case CommandType::Uniform: {
-				UniformData data = reader.ReadCmdUniform();
-				SetUniform_(data, boundShader);
-			} break;
-			case CommandType::Clear: {
-				ClearColor col = reader.ReadCmdClear();
-				Clear_(col.r, col.g, col.b, col.a);
-			} break;
-			case CommandType::End: break;
+	static bool IsSamplerType_(DataType type) {
+		return type == DataType::Uniform_Sampler2D || type == DataType::Uniform_SamplerCube;
+	}
+
+	static void SetUniform_(const UniformData &data, const OpenGL_ShaderRecord &boundShader) {
+		auto *uniform = boundShader.Object->GetUniform(data.Id);
+		if (!uniform) return;
+
+		// Sampler units may be recorded as plain ints.
+		bool typeMatches = data.Type == uniform->ElementType
+			|| (IsSamplerType_(uniform->ElementType) && (data.Type == DataType::Int32 || IsSamplerType_(data.Type)));
+		if (!uniform->Upload || !typeMatches || data.SizeX != uniform->SizeX || data.SizeY != uniform->SizeY) {
+			if (!uniform->Reported) {
+				fmt::print(stderr, "Uniform '{}' of GL type {:#x} can't be set from {} {}x{}\n",
+					data.Id.GetName(), uniform->Type, DataTypeToString(data.Type), (int)data.SizeX, (int)data.SizeY);
+				uniform->Reported = true;
 			}
+			return;
 		}
+
+		GLsizei count = data.Count < (uint32_t)uniform->Size ? data.Count : uniform->Size;
+		uniform->Upload(boundShader.Program, uniform->Location, count, data.Data.GetData());
 	}
 
-	static void SetUniform_(const UniformData &data, OpenGL_Shader *boundShader) {
-		auto loc = glGetUniformLocation(boundShader->Id, data.Name);
-		if (data.Type == DataType::Float32) {
-			auto v = (float*)data.Data.GetData();
-			// fmt::print("-----------\n");
-			// fmt::print("{} {} {} {}\n", v[0], v[1], v[2], v[3]);
-			// fmt::print("{} {} {} {}\n", v[4], v[5], v[6], v[7]);
-			// fmt::print("{} {} {} {}\n", v[8], v[9], v[10], v[11]);
-			// fmt::print("{} {} {} {}\n", v[12], v[13], v[14], v[15]);
-			// fmt::print("-----------\n\n");
-
-			if (data.SizeY == 1 || data.SizeX == data.SizeY)
-			switch (data.SizeX * data.SizeY) {
-			case  1: glProgramUniform1f(boundShader->Id, loc, v[0]); break;
-			case  2: glProgramUniform2f(boundShader->Id, loc, v[0], v[1]); break;
-			case  3: glProgramUniform3f(boundShader->Id, loc, v[0], v[1], v[2]); break;
-			case  4: glProgramUniform4f(boundShader->Id, loc, v[0], v[1], v[2], v[3]); break;
-			case  9: glProgramUniformMatrix3fv(boundShader->Id, loc, 1, GL_FALSE, v); break;
-			case 16: glProgramUniformMatrix4fv(boundShader->Id, loc, 1, GL_FALSE, v); break;
-			}
-		} else {
-			fmt::print(stderr, "SetUniform_ data type not yet supported! {}",
-				DataTypeToString(data.Type));
-			exit(1);
+	static void BindUniformBlock_(
+		OpenGL_StateCache &state, OpenGL_UniformRing &ring, OpenGL_StreamBuffer &stream, const UniformBlockData &data
+	) {
+		if (data.InUniformArena) {
+			state.BindUniformBufferRange(data.Binding, ring.GetBuffer(), data.ArenaOffset, data.Size);
+			return;
+		}
+		// Blocks from the side arena and from bundles are copied at submission,
+		// into the stream buffer of the frame being submitted. The uniform ring
+		// belongs to the frame being recorded, which may be a later one.
+		auto alloc = stream.Allocate(data.Size, ring.GetAlignment());
+		if (!alloc.Ptr) {
+			fmt::print(stderr, "Stream buffer is full, dropping uniform block for binding {}\n", data.Binding);
+			return;
 		}
+		CopyItems(alloc.Ptr, data.Data.GetData(), data.Size);
+		state.BindUniformBufferRange(data.Binding, stream.GetBuffer(), alloc.Offset, data.Size);
 	}
 
-	static void DrawMesh_(Ref<Mesh> mesh_, Ref<Shader> shader_) {
-		auto *shader = (OpenGL_Shader*)shader_.Get();
-		auto *mesh = (OpenGL_Mesh*)mesh_.Get();
+	static void BindMeshPool_(OpenGL_StateCache &state, OpenGL_VertexArrayCache &vaos, OpenGL_MeshPool *pool) {
+		vaos.Bind(state, pool->Layout, pool->VBO, pool->EBO);
+	}
 
-		glUseProgram(shader->Id);
-		glBindVertexArray(mesh->VAO);
+	static void DrawMesh_(
+		OpenGL_StateCache &state, OpenGL_VertexArrayCache &vaos,
+		const OpenGL_MeshRecord &mesh, const OpenGL_ShaderRecord &shader
+	) {
+		state.UseProgram(shader.Program);
+		BindMeshPool_(state, vaos, mesh.Pool);
 
-		if (mesh->IsIndexed()) {
-			glDrawElements(
+		if (mesh.IsIndexed()) {
+			glDrawElementsBaseVertex(
 				GL_TRIANGLES,
-				mesh->GetIndexCount(),
-				DataTypeToGLenum_(mesh->GetVertexSpec().IndexType),
-				nullptr
+				mesh.IndexCount,
+				mesh.IndexType,
+				(const void*)mesh.GetIndexByteOffset(),
+				mesh.BaseVertex
 			);
 		} else {
 			glDrawArrays(
 				GL_TRIANGLES,
-				0,
-				mesh->GetVertexCount()
+				mesh.BaseVertex,
+				mesh.VertexCount
 			);
 		}
 	}
 
-	static void Clear_(float r, float g, float b, float a) {
-		glClearColor(r, g, b, a);
+	static void DrawMeshInstanced_(
+		OpenGL_StateCache &state, OpenGL_VertexArrayCache &vaos, OpenGL_StreamBuffer &stream,
+		const OpenGL_MeshRecord &mesh, const InstancedDrawData &data, const OpenGL_ShaderRecord &shader
+	) {
+		if (data.InstanceCount == 0) return;
+
+		size_t stride = mesh.InstanceStride;
+		if (stride != 0) {
+			auto alloc = stream.Allocate(data.InstanceData.GetByteSize(), stride);
+			if (!alloc.Ptr) {
+				fmt::print(stderr, "Stream buffer is full, dropping draw of {} instances\n",
+					data.InstanceCount);
+				return;
+			}
+			CopyItems(alloc.Ptr, data.InstanceData.GetData(), data.InstanceData.GetByteSize());
+			glVertexArrayVertexBuffer(mesh.Pool->Layout->VAO, 1, stream.GetBuffer(), alloc.Offset, stride);
+		}
+
+		state.UseProgram(shader.Program);
+		BindMeshPool_(state, vaos, mesh.Pool);
+
+		if (mesh.IsIndexed()) {
+			glDrawElementsInstancedBaseVertex(
+				GL_TRIANGLES,
+				mesh.IndexCount,
+				mesh.IndexType,
+				(const void*)mesh.GetIndexByteOffset(),
+				data.InstanceCount,
+				mesh.BaseVertex
+			);
+		} else {
+			glDrawArraysInstanced(
+				GL_TRIANGLES,
+				mesh.BaseVertex,
+				mesh.VertexCount,
+				data.InstanceCount
+			);
+		}
+	}
+
+	struct DrawElementsIndirectCommand_ {
+		GLuint Count, InstanceCount, FirstIndex;
+		GLint BaseVertex;
+		GLuint BaseInstance;
+	};
+
+	static size_t DrawMeshes_(
+		OpenGL_StateCache &state, OpenGL_VertexArrayCache &vaos, OpenGL_StreamBuffer &stream,
+		const OpenGL_MeshMap &meshes, Span<const MeshHandle> handles, const OpenGL_ShaderRecord &shader
+	) {
+		// Runs of indexed meshes sharing a pool or heap block become one call.
+		auto batchable = [&](size_t i, const OpenGL_MeshPool *pool) {
+			const auto *mesh = meshes.Get(handles[i]);
+			return mesh && mesh->IsIndexed() && mesh->Pool == pool;
+		};
+
+		size_t i = 0, stale = 0;
+		while (i < handles.GetCount()) {
+			const auto *first = meshes.Get(handles[i]);
+			if (!first) {
+				stale += 1;
+				i += 1;
+				continue;
+			}
+			auto *pool = first->Pool;
+			bool batched = first->IsIndexed();
+			size_t runEnd = i + 1;
+			while (batched && runEnd < handles.GetCount() && batchable(runEnd, pool)) {
+				runEnd += 1;
+			}
+
+			size_t runLength = runEnd - i;
+			auto alloc = batched
+				? stream.Allocate(runLength * sizeof(DrawElementsIndirectCommand_), sizeof(GLuint))
+				: OpenGL_StreamBuffer::Allocation { nullptr, 0 };
+
+			if (!alloc.Ptr) {
+				// Unindexed, or out of stream space: draw one by one.
+				for (; i < runEnd; ++i) DrawMesh_(state, vaos, *meshes.Get(handles[i]), shader);
+				continue;
+			}
+
+			auto *commands = (DrawElementsIndirectCommand_*)alloc.Ptr;
+			for (size_t j = 0; j < runLength; ++j) {
+				const auto *mesh = meshes.Get(handles[i + j]);
+				commands[j] = {
+					(GLuint)mesh->IndexCount, 1,
+					(GLuint)mesh->FirstIndex, (GLint)mesh->BaseVertex, 0
+				};
+			}
+
+			state.UseProgram(shader.Program);
+			BindMeshPool_(state, vaos, pool);
+			state.BindBuffer(OpenGL_StateCache::BufferTarget::DrawIndirect, stream.GetBuffer());
+			glMultiDrawElementsIndirect(
+				GL_TRIANGLES,
+				first->IndexType,
+				(const void*)alloc.Offset,
+				runLength,
+				0
+			);
+			i = runEnd;
+		}
+		return stale;
+	}
+
+	static void Clear_(OpenGL_StateCache &state, float r, float g, float b, float a) {
+		state.ClearColor(r, g, b, a);
 		glClear(GL_COLOR_BUFFER_BIT);
 	}
 }
@@ -1,5 +1,6 @@
 #include <av/av.hh>
 #include <sys/stat.h>
+#include <cerrno>
 
 namespace av::fs {
 	size_t GetFileSize(const char *fname) {
@@ -13,4 +14,8 @@ namespace av::fs {
 		fstat(fileno(fptr), &st);
 		return st.st_size;
 	}
+
+	bool CreateDirectory(const char *path) {
+		return mkdir(path, 0755) == 0 || errno == EEXIST;
+	}
 }
@@ -0,0 +1,133 @@
+#include <av/renderthread.hh>
+
+namespace av::graphics {
+	RenderThread::RenderThread(
+		Renderer &renderer,
+		std::function<void()> start,
+		std::function<void()> present,
+		std::function<void()> stop
+	) : Renderer_(renderer), Start_(std::move(start)), Present_(std::move(present)), Stop_(std::move(stop)) {
+		// The first frames have slots nothing was submitted from yet, but go
+		// through the same wait as the rest so ReadyFrames_ counts them.
+		uint64_t frame = Renderer_.GetFrameIndex();
+		for (size_t i = 0; i < Renderer::FramesInFlight - 1; ++i) {
+			Jobs_.Push({ Job_::Kind::Wait, (frame + i) % Renderer::FramesInFlight, frame + i });
+		}
+		Thread_ = std::thread([this] { Run_(); });
+	}
+
+	Ref<CommandBuffer> RenderThread::BeginFrame() {
+		uint64_t frame = Renderer_.FrameIndex_;
+		for (uint64_t ready = ReadyFrames_.load(std::memory_order_acquire); ready <= frame;
+			ready = ReadyFrames_.load(std::memory_order_acquire)) {
+			ReadyFrames_.wait(ready);
+		}
+		return Renderer_.ResetFrame_(frame % Renderer::FramesInFlight);
+	}
+
+	void RenderThread::EndFrame() {
+		uint64_t frame = Renderer_.FrameIndex_;
+		Jobs_.Push({ Job_::Kind::Submit, frame % Renderer::FramesInFlight, frame });
+		// The slot of the frame this one lets the recording thread start on
+		// was last submitted before it, so the wait can follow right behind.
+		uint64_t next = frame + Renderer::FramesInFlight - 1;
+		Jobs_.Push({ Job_::Kind::Wait, next % Renderer::FramesInFlight, next });
+		Renderer_.FrameIndex_ += 1;
+	}
+
+	void RenderThread::Call_(void (*fn)(void *context), void *context) {
+		std::atomic<bool> done = false;
+		Jobs_.Push({ Job_::Kind::Call, 0, 0, fn, context, &done });
+		done.wait(false, std::memory_order_acquire);
+	}
+
+	void RenderThread::Stop() {
+		if (!Thread_.joinable()) return;
+		Jobs_.Push({ Job_::Kind::Stop });
+		Thread_.join();
+	}
+
+	void RenderThread::Run_() {
+		if (Start_) Start_();
+		for (;;) {
+			Job_ job = Jobs_.Pop();
+			switch (job.Type) {
+			case Job_::Kind::Submit:
+				Renderer_.SubmitFrame_(job.Slot, job.Frame);
+				if (Present_) Present_();
+				break;
+			case Job_::Kind::Wait:
+				Renderer_.WaitForFrame_(job.Slot);
+				ReadyFrames_.store(job.Frame + 1, std::memory_order_release);
+				ReadyFrames_.notify_one();
+				break;
+			case Job_::Kind::Call:
+				job.Fn(job.Context);
+				job.Done->store(true, std::memory_order_release);
+				job.Done->notify_one();
+				break;
+			case Job_::Kind::Stop:
+				if (Stop_) Stop_();
+				return;
+			}
+		}
+	}
+
+	Owned<Mesh> RenderThread::CreateMesh(Span<uint8_t> vertexData, Span<uint8_t> indexData, const VertexSpecification &spec) {
+		Mesh *mesh = nullptr;
+		Invoke([&] { mesh = Renderer_.CreateMesh(vertexData, indexData, spec).Release(); });
+		return mesh;
+	}
+
+	Owned<Mesh> RenderThread::CreateMesh(Span<uint8_t> vertexData, const VertexSpecification &spec) {
+		Mesh *mesh = nullptr;
+		Invoke([&] { mesh = Renderer_.CreateMesh(vertexData, spec).Release(); });
+		return mesh;
+	}
+
+	Owned<MeshPool> RenderThread::CreateMeshPool(const VertexSpecification &spec, size_t vertexCapacity, size_t indexCapacity) {
+		MeshPool *pool = nullptr;
+		Invoke([&] { pool = Renderer_.CreateMeshPool(spec, vertexCapacity, indexCapacity).Release(); });
+		return pool;
+	}
+
+	Owned<Mesh> RenderThread::CreateMesh(Ref<MeshPool> pool, Span<uint8_t> vertexData, Span<uint8_t> indexData) {
+		Mesh *mesh = nullptr;
+		Invoke([&] { mesh = Renderer_.CreateMesh(pool, vertexData, indexData).Release(); });
+		return mesh;
+	}
+
+	Owned<Shader> RenderThread::CreateShader(const char *vertexSource, const char *fragmentSource) {
+		Shader *shader = nullptr;
+		Invoke([&] { shader = Renderer_.CreateShader(vertexSource, fragmentSource).Release(); });
+		return shader;
+	}
+
+	Owned<Bundle> RenderThread::CreateBundle(Ref<CommandBuffer> cmdBuf) {
+		Bundle *bundle = nullptr;
+		Invoke([&] { bundle = Renderer_.CreateBundle(cmdBuf).Release(); });
+		return bundle;
+	}
+
+	ShaderStatus RenderThread::GetShaderStatus(Ref<Shader> shader) {
+		ShaderStatus status;
+		Invoke([&] { status = Renderer_.GetShaderStatus(shader); });
+		return status;
+	}
+
+	void RenderThread::DestroyMesh(Owned<Mesh> &&mesh) {
+		Invoke([&] { Renderer_.DestroyMesh(std::move(mesh)); });
+	}
+
+	void RenderThread::DestroyMeshPool(Owned<MeshPool> &&pool) {
+		Invoke([&] { Renderer_.DestroyMeshPool(std::move(pool)); });
+	}
+
+	void RenderThread::DestroyShader(Owned<Shader> &&shader) {
+		Invoke([&] { Renderer_.DestroyShader(std::move(shader)); });
+	}
+
+	void RenderThread::DestroyBundle(Owned<Bundle> &&bundle) {
+		Invoke([&] { Renderer_.DestroyBundle(std::move(bundle)); });
+	}
+}
@@ -0,0 +1,916 @@
+#include <av/av.hh>
+#include <av/render.hh>
+#include <av/software.hh>
+#include <fmt/core.h>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define AV_SOFTWARE_AVX2 1
+#endif
+
+namespace av::graphics {
+	class Software_Mesh : public Mesh {
+	public:
+		using Mesh::Mesh;
+
+		GrowingSpan<uint8_t> Vertices, Indices;
+		/// Set for meshes living in a pool.
+		class Software_MeshPool *Pool = nullptr;
+	};
+
+	class Software_MeshPool : public MeshPool {
+	public:
+		using MeshPool::MeshPool;
+
+		size_t UsedVertices = 0, UsedIndices = 0;
+	};
+
+	class Software_Bundle : public Bundle {
+	public:
+		using Bundle::Bundle;
+
+		/// Private copy of the recorded stream and arena.
+		GrowingSpan<uint8_t> Data, Arena;
+	};
+
+	/// Runs a job over an index range on a fixed set of workers. The calling
+	/// thread takes part, so a pool of N workers runs N + 1 wide.
+	class Software_ThreadPool_ {
+	public:
+		using Job = void (*)(void *context, size_t index);
+
+		explicit Software_ThreadPool_(size_t workerCount) {
+			for (size_t i = 0; i < workerCount; ++i) {
+				Workers_.emplace_back([this] { Work_(); });
+			}
+		}
+
+		~Software_ThreadPool_() {
+			{
+				std::lock_guard lock(Mutex_);
+				Quit_ = true;
+			}
+			Wake_.notify_all();
+			for (auto &worker : Workers_) worker.join();
+		}
+
+		/// Calls job(context, i) for every i < count, returning when all are done.
+		void Run(size_t count, Job job, void *context) {
+			if (Workers_.empty() || count <= 1) {
+				for (size_t i = 0; i < count; ++i) job(context, i);
+				return;
+			}
+
+			{
+				std::lock_guard lock(Mutex_);
+				Job_ = job;
+				Context_ = context;
+				Count_ = count;
+				Next_.store(0, std::memory_order_relaxed);
+				Active_ = Workers_.size();
+				Generation_ += 1;
+			}
+			Wake_.notify_all();
+			Drain_(job, context, count);
+
+			std::unique_lock lock(Mutex_);
+			Done_.wait(lock, [this] { return Active_ == 0; });
+		}
+
+		template<typename F>
+		void Run(size_t count, F &fn) {
+			Run(count, [](void *context, size_t index) { (*(F*)context)(index); }, &fn);
+		}
+
+	private:
+		void Drain_(Job job, void *context, size_t count) {
+			size_t index;
+			while ((index = Next_.fetch_add(1, std::memory_order_relaxed)) < count) {
+				job(context, index);
+			}
+		}
+
+		void Work_() {
+			uint64_t seen = 0;
+			std::unique_lock lock(Mutex_);
+			while (true) {
+				Wake_.wait(lock, [&] { return Quit_ || Generation_ != seen; });
+				if (Quit_) return;
+				seen = Generation_;
+
+				Job job = Job_;
+				void *context = Context_;
+				size_t count = Count_;
+				lock.unlock();
+				Drain_(job, context, count);
+				lock.lock();
+
+				if (--Active_ == 0) Done_.notify_one();
+			}
+		}
+
+		std::vector<std::thread> Workers_;
+		std::mutex Mutex_;
+		std::condition_variable Wake_, Done_;
+		uint64_t Generation_ = 0;
+		size_t Active_ = 0, Count_ = 0;
+		std::atomic<size_t> Next_ = 0;
+		Job Job_ = nullptr;
+		void *Context_ = nullptr;
+		bool Quit_ = false;
+	};
+
+	/// Value across a triangle as X * x + Y * y + C, at pixel centers.
+	struct Software_Plane_ {
+		float X, Y, C;
+	};
+
+	struct Software_Triangle_ {
+		/// Edge functions, positive inside. Pixels exactly on an edge belong to
+		/// the triangle only if it's a top or left edge, whose mask is all ones.
+		Software_Plane_ Edges[3];
+		uint32_t TopLeft[3];
+		/// Depth, 1/w, and the texture coordinates divided by w.
+		Software_Plane_ Z, InvW, U, V;
+		/// Pixel bounds, exclusive at the end.
+		int32_t MinX, MinY, MaxX, MaxY;
+	};
+
+	/// Pixel rectangle of one triangle within one tile.
+	struct Software_Span_ {
+		int32_t X0, Y0, X1, Y1;
+	};
+
+	using Software_RasterFn_ = void (*)(
+		const Software_Triangle_ &tri, const Software_Span_ &span,
+		Software_Framebuffer &target, bool depthTest
+	);
+
+	static uint32_t PackUnorm8_(float c) {
+		c = c > 0.0f ? c : 0.0f;
+		c = c < 1.0f ? c : 1.0f;
+		return (uint32_t)(c * 255.0f + 0.5f);
+	}
+
+	/// main.frag: vec4(sTexCoord * 0.5 + 0.5, 1.0, 1.0).
+	static uint32_t ShadeScalar_(float u, float v) {
+		return PackUnorm8_(u * 0.5f + 0.5f)
+			| PackUnorm8_(v * 0.5f + 0.5f) << 8
+			| 0xFFu << 16
+			| 0xFFu << 24;
+	}
+
+	static void RasterizeScalar_(
+		const Software_Triangle_ &tri, const Software_Span_ &span,
+		Software_Framebuffer &target, bool depthTest
+	) {
+		const auto *e = tri.Edges;
+		for (int32_t y = span.Y0; y < span.Y1; ++y) {
+			float py = y + 0.5f;
+			float rows[3] = {
+				e[0].Y * py + e[0].C, e[1].Y * py + e[1].C, e[2].Y * py + e[2].C
+			};
+			float zRow = tri.Z.Y * py + tri.Z.C;
+			float wRow = tri.InvW.Y * py + tri.InvW.C;
+			float uRow = tri.U.Y * py + tri.U.C;
+			float vRow = tri.V.Y * py + tri.V.C;
+			uint32_t *color = target.GetColorRow(y);
+			float *depth = target.GetDepthRow(y);
+
+			for (int32_t x = span.X0; x < span.X1; ++x) {
+				float px = x + 0.5f;
+				bool inside = true;
+				for (int i = 0; i < 3; ++i) {
+					float d = e[i].X * px + rows[i];
+					inside = inside && (d > 0.0f || (d == 0.0f && tri.TopLeft[i]));
+				}
+				if (!inside) continue;
+
+				float z = tri.Z.X * px + zRow;
+				if (depthTest && !(z < depth[x])) continue;
+
+				float w = 1.0f / (tri.InvW.X * px + wRow);
+				float u = (tri.U.X * px + uRow) * w;
+				float v = (tri.V.X * px + vRow) * w;
+				depth[x] = z;
+				color[x] = ShadeScalar_(u, v);
+			}
+		}
+	}
+
+#if AV_SOFTWARE_AVX2
+	/// Same arithmetic as the scalar path, in the same order, so both produce
+	/// identical images.
+	__attribute__((target("avx2")))
+	static __m256i PackUnorm8x8_(__m256 c) {
+		c = _mm256_max_ps(c, _mm256_setzero_ps());
+		c = _mm256_min_ps(c, _mm256_set1_ps(1.0f));
+		c = _mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps(255.0f)), _mm256_set1_ps(0.5f));
+		return _mm256_cvttps_epi32(c);
+	}
+
+	__attribute__((target("avx2")))
+	static void RasterizeAVX2_(
+		const Software_Triangle_ &tri, const Software_Span_ &span,
+		Software_Framebuffer &target, bool depthTest
+	) {
+		const auto *e = tri.Edges;
+		const __m256 zero = _mm256_setzero_ps();
+		const __m256 half = _mm256_set1_ps(0.5f);
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 centers = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		const __m256i spanStart = _mm256_set1_epi32(span.X0 - 1);
+		const __m256i spanEnd = _mm256_set1_epi32(span.X1);
+		const __m256i constantColor = _mm256_set1_epi32((int)(0xFFu << 16 | 0xFFu << 24));
+
+		__m256 edgeX[3], topLeft[3];
+		for (int i = 0; i < 3; ++i) {
+			edgeX[i] = _mm256_set1_ps(e[i].X);
+			topLeft[i] = _mm256_castsi256_ps(_mm256_set1_epi32((int)tri.TopLeft[i]));
+		}
+		const __m256 zX = _mm256_set1_ps(tri.Z.X), wX = _mm256_set1_ps(tri.InvW.X);
+		const __m256 uX = _mm256_set1_ps(tri.U.X), vX = _mm256_set1_ps(tri.V.X);
+
+		for (int32_t y = span.Y0; y < span.Y1; ++y) {
+			float py = y + 0.5f;
+			__m256 rows[3];
+			for (int i = 0; i < 3; ++i) rows[i] = _mm256_set1_ps(e[i].Y * py + e[i].C);
+			__m256 zRow = _mm256_set1_ps(tri.Z.Y * py + tri.Z.C);
+			__m256 wRow = _mm256_set1_ps(tri.InvW.Y * py + tri.InvW.C);
+			__m256 uRow = _mm256_set1_ps(tri.U.Y * py + tri.U.C);
+			__m256 vRow = _mm256_set1_ps(tri.V.Y * py + tri.V.C);
+			uint32_t *color = target.GetColorRow(y);
+			float *depth = target.GetDepthRow(y);
+
+			for (int32_t x = span.X0 & ~7; x < span.X1; x += 8) {
+				__m256 px = _mm256_add_ps(_mm256_set1_ps((float)x), centers);
+				__m256i xs = _mm256_add_epi32(_mm256_set1_epi32(x), lanes);
+				__m256 mask = _mm256_castsi256_ps(_mm256_and_si256(
+					_mm256_cmpgt_epi32(xs, spanStart),
+					_mm256_cmpgt_epi32(spanEnd, xs)
+				));
+				for (int i = 0; i < 3; ++i) {
+					__m256 d = _mm256_add_ps(_mm256_mul_ps(edgeX[i], px), rows[i]);
+					__m256 in = _mm256_or_ps(
+						_mm256_cmp_ps(d, zero, _CMP_GT_OQ),
+						_mm256_and_ps(_mm256_cmp_ps(d, zero, _CMP_EQ_OQ), topLeft[i])
+					);
+					mask = _mm256_and_ps(mask, in);
+				}
+				if (_mm256_testz_ps(mask, mask)) continue;
+
+				__m256 z = _mm256_add_ps(_mm256_mul_ps(zX, px), zRow);
+				if (depthTest) {
+					mask = _mm256_and_ps(mask, _mm256_cmp_ps(z, _mm256_loadu_ps(depth + x), _CMP_LT_OQ));
+					if (_mm256_testz_ps(mask, mask)) continue;
+				}
+
+				__m256 w = _mm256_div_ps(one, _mm256_add_ps(_mm256_mul_ps(wX, px), wRow));
+				__m256 u = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(uX, px), uRow), w);
+				__m256 v = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(vX, px), vRow), w);
+				__m256i r = PackUnorm8x8_(_mm256_add_ps(_mm256_mul_ps(u, half), half));
+				__m256i g = PackUnorm8x8_(_mm256_add_ps(_mm256_mul_ps(v, half), half));
+				__m256i rgba = _mm256_or_si256(
+					_mm256_or_si256(r, _mm256_slli_epi32(g, 8)),
+					constantColor
+				);
+
+				__m256i store = _mm256_castps_si256(mask);
+				_mm256_maskstore_ps(depth + x, store, z);
+				_mm256_maskstore_epi32((int*)(color + x), store, rgba);
+			}
+		}
+	}
+#endif
+
+	static bool CPUHasAVX2_() {
+#if AV_SOFTWARE_AVX2
+		return __builtin_cpu_supports("avx2");
+#else
+		return false;
+#endif
+	}
+
+	/// Vertex after the vertex stage: clip-space position and the varyings
+	/// main.frag reads.
+	struct Software_ClipVertex_ {
+		float X, Y, Z, W, U, V;
+	};
+
+	/// Bins triangles into screen tiles as draws come in, then rasterizes all
+	/// tiles in parallel when resolved. Each tile replays its triangles in
+	/// submission order, so the image doesn't depend on the thread count.
+	class Software_Rasterizer {
+	public:
+		Software_Rasterizer(uint32_t width, uint32_t height, size_t threadCount)
+			: Pool_(threadCount == 0
+				? (std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0)
+				: threadCount - 1)
+		{
+			Target_.Resize(width, height);
+			TilesX_ = (width + Software_Renderer::TileSize - 1) / Software_Renderer::TileSize;
+			TilesY_ = (height + Software_Renderer::TileSize - 1) / Software_Renderer::TileSize;
+			Bins_ = std::make_unique<GrowingSpan<uint32_t>[]>(TilesX_ * TilesY_);
+			SetUseSIMD(true);
+		}
+
+		Software_ThreadPool_ &GetPool() { return Pool_; }
+		/// Per-draw output of the vertex stage.
+		GrowingSpan<Software_ClipVertex_> &GetClipVertices() { return ClipVertices_; }
+		const Software_Framebuffer &GetTarget() const { return Target_; }
+
+		void SetDepthTest(bool enabled) { DepthTest_ = enabled; }
+		void SetUseSIMD(bool enabled) {
+#if AV_SOFTWARE_AVX2
+			if (enabled && CPUHasAVX2_()) {
+				Raster_ = RasterizeAVX2_;
+				return;
+			}
+#endif
+			Raster_ = RasterizeScalar_;
+		}
+		bool IsUsingSIMD() const { return Raster_ != RasterizeScalar_; }
+
+		/// Screen extent, in multiples of the viewport around its center, past
+		/// which triangles are clipped rather than left to the bounds clamp.
+		/// Keeps screen coordinates small enough for exact edge setup.
+		static constexpr float GuardBand = 8.0f;
+
+		/// Culls the triangle if it's entirely off screen, clips it against
+		/// the near and far planes and, if it reaches that far, the guard
+		/// band, then sets up and bins what's left.
+		void SubmitTriangle(
+			const Software_ClipVertex_ &a,
+			const Software_ClipVertex_ &b,
+			const Software_ClipVertex_ &c
+		) {
+			// Near, far, then the guard band's left, right, bottom and top. In
+			// double, since vertices far enough out to need the guard band
+			// would lose the small distances to float rounding.
+			auto distance = [](int plane, const Software_ClipVertex_ &v) {
+				switch (plane) {
+				case 0: return (double)v.W + v.Z;
+				case 1: return (double)v.W - v.Z;
+				case 2: return (double)GuardBand * v.W + v.X;
+				case 3: return (double)GuardBand * v.W - v.X;
+				case 4: return (double)GuardBand * v.W + v.Y;
+				default: return (double)GuardBand * v.W - v.Y;
+				}
+			};
+			auto outside = [](const Software_ClipVertex_ &v) {
+				return (v.X < -v.W) | (v.X > v.W) << 1 | (v.Y < -v.W) << 2 | (v.Y > v.W) << 3;
+			};
+			if (outside(a) & outside(b) & outside(c)) return;
+
+			// Each plane adds at most one vertex.
+			Software_ClipVertex_ polygon[2][9] = { { a, b, c } };
+			size_t count = 3;
+			int current = 0;
+			for (int plane = 0; plane < 6; ++plane) {
+				const auto *in = polygon[current];
+				bool crosses = false;
+				for (size_t i = 0; i < count; ++i) crosses |= distance(plane, in[i]) < 0;
+				if (!crosses) continue;
+
+				auto *out = polygon[current ^ 1];
+				size_t outCount = 0;
+				for (size_t i = 0; i < count; ++i) {
+					const auto &p = in[i], &q = in[(i + 1) % count];
+					double dp = distance(plane, p), dq = distance(plane, q);
+					if (dp >= 0) out[outCount++] = p;
+					if ((dp >= 0) != (dq >= 0)) {
+						double t = dp / (dp - dq);
+						auto lerp = [t](float a, float b) { return (float)(a + ((double)b - a) * t); };
+						out[outCount++] = {
+							lerp(p.X, q.X), lerp(p.Y, q.Y), lerp(p.Z, q.Z),
+							lerp(p.W, q.W), lerp(p.U, q.U), lerp(p.V, q.V),
+						};
+					}
+				}
+				count = outCount;
+				current ^= 1;
+				if (count < 3) return;
+			}
+
+			const auto *clipped = polygon[current];
+			for (size_t i = 2; i < count; ++i) {
+				SetupTriangle_(clipped[0], clipped[i - 1], clipped[i]);
+			}
+		}
+
+		/// Rasterizes everything binned so far.
+		void Resolve() {
+			if (Triangles_.GetCount() == 0) return;
+			auto job = [this](size_t tile) { RasterizeTile_(tile); };
+			Pool_.Run(TilesX_ * TilesY_, job);
+			Triangles_.Clear();
+			for (size_t i = 0; i < TilesX_ * TilesY_; ++i) Bins_[i].Clear();
+		}
+
+		void Clear(float r, float g, float b, float a) {
+			Resolve();
+			uint32_t color = PackUnorm8_(r) | PackUnorm8_(g) << 8 | PackUnorm8_(b) << 16 | PackUnorm8_(a) << 24;
+			auto job = [&](size_t y) {
+				uint32_t *colorRow = Target_.GetColorRow(y);
+				float *depthRow = Target_.GetDepthRow(y);
+				for (uint32_t x = 0; x < Target_.GetStride(); ++x) {
+					colorRow[x] = color;
+					depthRow[x] = 1.0f;
+				}
+			};
+			Pool_.Run(Target_.GetHeight(), job);
+		}
+
+	private:
+		struct ScreenVertex_ {
+			float X, Y, Z, InvW, U, V;
+		};
+
+		ScreenVertex_ Project_(const Software_ClipVertex_ &v) const {
+			float invW = 1.0f / v.W;
+			float x = (v.X * invW * 0.5f + 0.5f) * Target_.GetWidth();
+			float y = (0.5f - v.Y * invW * 0.5f) * Target_.GetHeight();
+			// Snap to 1/16 pixel so edges are stable under tiny transform changes.
+			return {
+				std::round(x * 16.0f) / 16.0f,
+				std::round(y * 16.0f) / 16.0f,
+				v.Z * invW * 0.5f + 0.5f,
+				invW, v.U * invW, v.V * invW
+			};
+		}
+
+		void SetupTriangle_(
+			const Software_ClipVertex_ &c0,
+			const Software_ClipVertex_ &c1,
+			const Software_ClipVertex_ &c2
+		) {
+			ScreenVertex_ s[3] = { Project_(c0), Project_(c1), Project_(c2) };
+			float area = (s[1].X - s[0].X) * (s[2].Y - s[0].Y) - (s[1].Y - s[0].Y) * (s[2].X - s[0].X);
+			if (area == 0.0f || !std::isfinite(area)) return;
+			// Nothing is culled, as in the OpenGL backend; flip to a single winding.
+			if (area < 0) {
+				ScreenVertex_ t = s[1]; s[1] = s[2]; s[2] = t;
+				area = -area;
+			}
+
+			Software_Triangle_ tri;
+			float minX = s[0].X, maxX = s[0].X, minY = s[0].Y, maxY = s[0].Y;
+			for (int i = 0; i < 3; ++i) {
+				const auto &a = s[(i + 1) % 3], &b = s[(i + 2) % 3];
+				// Edge opposite vertex i, from a to b.
+				auto &edge = tri.Edges[i];
+				edge.X = a.Y - b.Y;
+				edge.Y = b.X - a.X;
+				edge.C = -edge.Y * a.Y - edge.X * a.X;
+				tri.TopLeft[i] = edge.X > 0 || (edge.X == 0 && edge.Y > 0) ? ~0u : 0u;
+
+				minX = s[i].X < minX ? s[i].X : minX;
+				maxX = s[i].X > maxX ? s[i].X : maxX;
+				minY = s[i].Y < minY ? s[i].Y : minY;
+				maxY = s[i].Y > maxY ? s[i].Y : maxY;
+			}
+
+			float e1x = s[1].X - s[0].X, e1y = s[1].Y - s[0].Y;
+			float e2x = s[2].X - s[0].X, e2y = s[2].Y - s[0].Y;
+			auto plane = [&](float a0, float a1, float a2) {
+				float d1 = a1 - a0, d2 = a2 - a0;
+				Software_Plane_ p;
+				p.X = (d1 * e2y - d2 * e1y) / area;
+				p.Y = (d2 * e1x - d1 * e2x) / area;
+				p.C = a0 - p.X * s[0].X - p.Y * s[0].Y;
+				return p;
+			};
+			tri.Z = plane(s[0].Z, s[1].Z, s[2].Z);
+			tri.InvW = plane(s[0].InvW, s[1].InvW, s[2].InvW);
+			tri.U = plane(s[0].U, s[1].U, s[2].U);
+			tri.V = plane(s[0].V, s[1].V, s[2].V);
+
+			// Clamped while still floats, so the conversions are always in range.
+			float width = Target_.GetWidth(), height = Target_.GetHeight();
+			tri.MinX = (int32_t)std::floor(std::clamp(minX, 0.0f, width));
+			tri.MinY = (int32_t)std::floor(std::clamp(minY, 0.0f, height));
+			tri.MaxX = (int32_t)std::min(std::ceil(std::clamp(maxX, 0.0f, width)) + 1.0f, width);
+			tri.MaxY = (int32_t)std::min(std::ceil(std::clamp(maxY, 0.0f, height)) + 1.0f, height);
+			if (tri.MinX >= tri.MaxX || tri.MinY >= tri.MaxY) return;
+
+			uint32_t index = Triangles_.GetCount();
+			Triangles_.Push(tri);
+			Bin_(tri, index);
+		}
+
+		void Bin_(const Software_Triangle_ &tri, uint32_t index) {
+			const int32_t size = Software_Renderer::TileSize;
+			for (int32_t ty = tri.MinY / size; ty <= (tri.MaxY - 1) / size; ++ty) {
+				for (int32_t tx = tri.MinX / size; tx <= (tri.MaxX - 1) / size; ++tx) {
+					// Skip tiles entirely outside an edge: test the pixel center
+					// where that edge function is largest.
+					bool outside = false;
+					for (const auto &edge : tri.Edges) {
+						float cx = (edge.X > 0 ? (tx + 1) * size - 1 : tx * size) + 0.5f;
+						float cy = (edge.Y > 0 ? (ty + 1) * size - 1 : ty * size) + 0.5f;
+						if (edge.X * cx + edge.Y * cy + edge.C < 0) outside = true;
+					}
+					if (!outside) Bins_[ty * TilesX_ + tx].Push(index);
+				}
+			}
+		}
+
+		void RasterizeTile_(size_t tile) {
+			const int32_t size = Software_Renderer::TileSize;
+			int32_t tx = tile % TilesX_, ty = tile / TilesX_;
+			for (uint32_t index : Bins_[tile]) {
+				const auto &tri = Triangles_[index];
+				Software_Span_ span {
+					std::max(tri.MinX, tx * size), std::max(tri.MinY, ty * size),
+					std::min(tri.MaxX, (tx + 1) * size), std::min(tri.MaxY, (ty + 1) * size),
+				};
+				Raster_(tri, span, Target_, DepthTest_);
+			}
+		}
+
+		Software_ThreadPool_ Pool_;
+		Software_Framebuffer Target_;
+		GrowingSpan<Software_ClipVertex_> ClipVertices_;
+		size_t TilesX_, TilesY_;
+		GrowingSpan<Software_Triangle_> Triangles_;
+		std::unique_ptr<GrowingSpan<uint32_t>[]> Bins_;
+		Software_RasterFn_ Raster_;
+		bool DepthTest_ = false;
+	};
+
+	void Software_Framebuffer::Resize(uint32_t width, uint32_t height) {
+		Width_ = width;
+		Height_ = height;
+		Stride_ = (width + 7) & ~7u;
+		Color_.Resize(Stride_ * height);
+		Depth_.Resize(Stride_ * height);
+		for (auto &c : Color_) c = 0;
+		for (auto &d : Depth_) d = 1.0f;
+	}
+
+	bool Software_Framebuffer::WritePPM(const char *filename) const {
+		FILE *f = fopen(filename, "wb");
+		if (!f) {
+			fmt::print(stderr, "Failed to open {} for writing\n", filename);
+			return false;
+		}
+		fmt::print(f, "P6\n{} {}\n255\n", Width_, Height_);
+		GrowingSpan<uint8_t> row;
+		row.Resize(Width_ * 3);
+		for (uint32_t y = 0; y < Height_; ++y) {
+			const uint32_t *colors = GetColorRow(y);
+			for (uint32_t x = 0; x < Width_; ++x) {
+				row[x * 3 + 0] = colors[x] & 0xFF;
+				row[x * 3 + 1] = colors[x] >> 8 & 0xFF;
+				row[x * 3 + 2] = colors[x] >> 16 & 0xFF;
+			}
+			fwrite(row.GetData(), 1, row.GetCount(), f);
+		}
+		fclose(f);
+		return true;
+	}
+
+	Software_Renderer::Software_Renderer(uint32_t width, uint32_t height, size_t threadCount)
+		: Rasterizer_(new Software_Rasterizer(width, height, threadCount)) {}
+
+	Software_Renderer::~Software_Renderer() = default;
+
+	const Software_Framebuffer &Software_Renderer::GetFramebuffer() const {
+		return Rasterizer_->GetTarget();
+	}
+
+	void Software_Renderer::SetDepthTest(bool enabled) { Rasterizer_->SetDepthTest(enabled); }
+	void Software_Renderer::SetUseSIMD(bool enabled) { Rasterizer_->SetUseSIMD(enabled); }
+	bool Software_Renderer::IsUsingSIMD() const { return Rasterizer_->IsUsingSIMD(); }
+
+	void Software_Renderer::Initialize() {
+		UniformArena_.Create(UniformArenaSize);
+	}
+
+	void Software_Renderer::DeInitialize() {
+	}
+
+	void Software_Renderer::WaitForFrame_(size_t slot) {
+		// Flushes finish on the CPU before returning; nothing is ever in flight.
+	}
+
+	UniformArena *Software_Renderer::BeginUniformArena_(size_t slot) {
+		UniformArena_.BeginFrame(slot);
+		return &UniformArena_;
+	}
+
+	void Software_Renderer::SignalFrame_(size_t slot, uint64_t frame) {
+	}
+
+	/// Creates the mesh with a copy of its data and records it in the slot map.
+	static Owned<Mesh> AddMesh_(
+		SlotMap<Mesh, const Mesh*> &meshes, Software_MeshPool *pool,
+		bool indexed, size_t vertexCount, size_t indexCount, const VertexSpecification &spec,
+		Span<uint8_t> vertexData, Span<uint8_t> indexData
+	) {
+		auto handle = meshes.Insert(nullptr);
+		if (!handle.IsValid()) return {};
+		auto *mesh = new Software_Mesh(handle, indexed, vertexCount, indexCount, spec);
+		mesh->Pool = pool;
+		if (vertexData.GetCount()) {
+			CopyItems(mesh->Vertices.Extend(vertexData.GetCount()), vertexData.GetData(), vertexData.GetCount());
+		}
+		if (indexData.GetCount()) {
+			CopyItems(mesh->Indices.Extend(indexData.GetCount()), indexData.GetData(), indexData.GetCount());
+		}
+		*meshes.Get(handle) = mesh;
+		return Owned<Mesh>(mesh);
+	}
+
+	Owned<Mesh> Software_Renderer::CreateMesh(
+		Span<uint8_t> vertexData,
+		Span<uint8_t> indexData,
+		const VertexSpecification &spec
+	) {
+		return AddMesh_(
+			Meshes_, nullptr, true,
+			vertexData.GetByteSize() / spec.PackedSize(),
+			indexData.GetByteSize() / VertexAttribute::GetElementSize(spec.IndexType),
+			spec, vertexData, indexData
+		);
+	}
+
+	Owned<Mesh> Software_Renderer::CreateMesh(
+		Span<uint8_t> vertexData,
+		const VertexSpecification &spec
+	) {
+		return AddMesh_(Meshes_, nullptr, false, vertexData.GetByteSize() / spec.PackedSize(), 0, spec, vertexData, {});
+	}
+
+	Owned<MeshPool> Software_Renderer::CreateMeshPool(
+		const VertexSpecification &spec,
+		size_t vertexCapacity,
+		size_t indexCapacity
+	) {
+		return Owned<MeshPool>(new Software_MeshPool(spec, vertexCapacity, indexCapacity));
+	}
+
+	Owned<Mesh> Software_Renderer::CreateMesh(
+		Ref<MeshPool> pool_,
+		Span<uint8_t> vertexData,
+		Span<uint8_t> indexData
+	) {
+		auto *pool = (Software_MeshPool*)pool_.Get();
+		const auto &spec = pool->GetVertexSpec();
+		size_t vertexCount = vertexData.GetByteSize() / spec.PackedSize();
+		size_t indexCount = indexData.GetByteSize() / VertexAttribute::GetElementSize(spec.IndexType);
+		if (pool->UsedVertices + vertexCount > pool->GetVertexCapacity()) return {};
+		if (pool->UsedIndices + indexCount > pool->GetIndexCapacity()) return {};
+
+		auto mesh = AddMesh_(Meshes_, pool, true, vertexCount, indexCount, spec, vertexData, indexData);
+		if (!mesh.Get()) return {};
+		pool->UsedVertices += vertexCount;
+		pool->UsedIndices += indexCount;
+		return Owned<Mesh>(mesh.Release());
+	}
+
+	Owned<Shader> Software_Renderer::CreateShader(const char *vertexSource, const char *fragmentSource) {
+		auto handle = Shaders_.Insert(nullptr);
+		if (!handle.IsValid()) return {};
+		auto *shader = new Shader(handle);
+		*Shaders_.Get(handle) = shader;
+		return Owned<Shader>(shader);
+	}
+
+	Owned<Bundle> Software_Renderer::CreateBundle(Ref<CommandBuffer> cmdBuf) {
+		auto recorded = cmdBuf->GetData();
+		auto arena = cmdBuf->GetArena();
+		if (!ValidateBundleData(recorded, arena)) return {};
+
+		auto *bundle = new Software_Bundle(cmdBuf->GetCount());
+		CopyItems(bundle->Data.Extend(recorded.GetCount()), recorded.GetData(), recorded.GetCount());
+		if (arena.GetCount()) CopyItems(bundle->Arena.Extend(arena.GetCount()), arena.GetData(), arena.GetCount());
+		return Owned<Bundle>(bundle);
+	}
+
+	void Software_Renderer::DestroyBundle(Owned<Bundle> &&bundle) {
+	}
+
+	void Software_Renderer::DestroyMesh(Owned<Mesh> &&mesh) {
+		auto *m = (Software_Mesh*)mesh.Get();
+		Meshes_.Remove(m->GetHandle());
+		if (!m->Pool) return;
+		m->Pool->UsedVertices -= m->GetVertexCount();
+		m->Pool->UsedIndices -= m->GetIndexCount();
+	}
+
+	void Software_Renderer::DestroyMeshPool(Owned<MeshPool> &&pool) {
+	}
+
+	void Software_Renderer::DestroyShader(Owned<Shader> &&shader) {
+		Shaders_.Remove(shader->GetHandle());
+	}
+
+	/// Reads one component as a float, converted like the GL backend's
+	/// attribute formats: normalized integers map to [0, 1] or [-1, 1].
+	static float ReadComponent_(const uint8_t *p, DataType type, bool normalized) {
+		auto snorm = [](float v, float max) { return v / max < -1.0f ? -1.0f : v / max; };
+		switch (type) {
+		case DataType::Float32: { float v; CopyItems((uint8_t*)&v, p, sizeof(v)); return v; }
+		case DataType::Float64: { double v; CopyItems((uint8_t*)&v, p, sizeof(v)); return (float)v; }
+		case DataType::Half16: { uint16_t v; CopyItems((uint8_t*)&v, p, sizeof(v)); return HalfToFloat(v); }
+		case DataType::Int8: { float v = *(const int8_t*)p; return normalized ? snorm(v, 127.0f) : v; }
+		case DataType::UInt8: { float v = *p; return normalized ? v / 255.0f : v; }
+		case DataType::Int16: { int16_t v; CopyItems((uint8_t*)&v, p, sizeof(v)); return normalized ? snorm(v, 32767.0f) : v; }
+		case DataType::UInt16: { uint16_t v; CopyItems((uint8_t*)&v, p, sizeof(v)); return normalized ? v / 65535.0f : v; }
+		case DataType::Int32: { int32_t v; CopyItems((uint8_t*)&v, p, sizeof(v)); return normalized ? snorm((float)v, 2147483647.0f) : (float)v; }
+		case DataType::UInt32: { uint32_t v; CopyItems((uint8_t*)&v, p, sizeof(v)); return normalized ? (float)v / 4294967295.0f : (float)v; }
+		case DataType::Int64: { int64_t v; CopyItems((uint8_t*)&v, p, sizeof(v)); return (float)v; }
+		case DataType::UInt64: { uint64_t v; CopyItems((uint8_t*)&v, p, sizeof(v)); return (float)v; }
+		default: return 0.0f;
+		}
+	}
+
+	/// Splits a 2_10_10_10 word into its four components.
+	static void ReadPacked_(const uint8_t *p, DataType type, bool normalized, float out[4]) {
+		uint32_t word;
+		CopyItems((uint8_t*)&word, p, sizeof(word));
+		const uint32_t bits[4] = { 10, 10, 10, 2 };
+		for (size_t i = 0, shift = 0; i < 4; shift += bits[i], ++i) {
+			uint32_t field = (word >> shift) & ((1u << bits[i]) - 1);
+			float max = (float)((1u << bits[i]) - 1);
+			if (type == DataType::Int_2_10_10_10_Rev) {
+				// Sign-extend the field from its top bit.
+				int32_t value = (int32_t)(field << (32 - bits[i])) >> (32 - bits[i]);
+				max = (float)((1u << (bits[i] - 1)) - 1);
+				out[i] = normalized ? (value / max < -1.0f ? -1.0f : value / max) : (float)value;
+			} else {
+				out[i] = normalized ? field / max : (float)field;
+			}
+		}
+	}
+
+	/// Where an attribute location sits in a vertex, following SetupVertexArray_.
+	struct Software_AttributeFetch_ {
+		const VertexAttribute *Attribute = nullptr;
+		size_t Offset = 0;
+
+		/// Missing components default to (0, 0, 0, 1), as in GL.
+		void Read(const uint8_t *vertex, float out[4]) const {
+			out[0] = out[1] = out[2] = 0.0f;
+			out[3] = 1.0f;
+			if (!Attribute) return;
+			if (VertexAttribute::IsPackedType(Attribute->Type)) {
+				ReadPacked_(vertex + Offset, Attribute->Type, Attribute->Normalized, out);
+				return;
+			}
+			size_t elementSize = Attribute->GetElementSize();
+			for (size_t i = 0; i < Attribute->Dimension && i < 4; ++i) {
+				out[i] = ReadComponent_(vertex + Offset + i * elementSize, Attribute->Type, Attribute->Normalized);
+			}
+		}
+	};
+
+	static Software_AttributeFetch_ FindAttribute_(const VertexSpecification &spec, size_t location) {
+		size_t offset = 0, index = 0;
+		for (const auto &attr : spec.Attributes) {
+			if (attr.Divisor != 0) {
+				index += 1;
+				continue;
+			}
+			if (index == location) return { &attr, offset };
+			offset += attr.GetPackedSize();
+			index += 1;
+		}
+		return {};
+	}
+
+	void Software_Renderer::DrawMesh_(MeshHandle handle) {
+		auto *found = Meshes_.Get(handle);
+		// Destroyed before the flush.
+		if (!found) return;
+		const auto *mesh = (const Software_Mesh*)*found;
+		const auto &spec = mesh->GetVertexSpec();
+		size_t stride = spec.PackedSize();
+		auto position = FindAttribute_(spec, 0);
+		auto texCoord = FindAttribute_(spec, 2);
+		const float *m = Transform_;
+
+		// Vertex stage, in parallel chunks.
+		auto &clip = Rasterizer_->GetClipVertices();
+		size_t vertexCount = mesh->GetVertexCount();
+		clip.Resize(vertexCount);
+		const size_t chunkSize = 4096;
+		auto transform = [&](size_t chunk) {
+			size_t end = std::min(vertexCount, (chunk + 1) * chunkSize);
+			for (size_t i = chunk * chunkSize; i < end; ++i) {
+				const uint8_t *vertex = mesh->Vertices.GetData() + i * stride;
+				float p[4], t[4];
+				position.Read(vertex, p);
+				texCoord.Read(vertex, t);
+				auto &out = clip[i];
+				out.X = m[0] * p[0] + m[4] * p[1] + m[8] * p[2] + m[12] * p[3];
+				out.Y = m[1] * p[0] + m[5] * p[1] + m[9] * p[2] + m[13] * p[3];
+				out.Z = m[2] * p[0] + m[6] * p[1] + m[10] * p[2] + m[14] * p[3];
+				out.W = m[3] * p[0] + m[7] * p[1] + m[11] * p[2] + m[15] * p[3];
+				out.U = t[0];
+				out.V = t[1];
+			}
+		};
+		Rasterizer_->GetPool().Run((vertexCount + chunkSize - 1) / chunkSize, transform);
+
+		// Primitive assembly.
+		if (!mesh->IsIndexed()) {
+			for (size_t i = 0; i + 2 < vertexCount; i += 3) {
+				Rasterizer_->SubmitTriangle(clip[i], clip[i + 1], clip[i + 2]);
+			}
+			return;
+		}
+
+		size_t indexSize = VertexAttribute::GetElementSize(spec.IndexType);
+		const uint8_t *indices = mesh->Indices.GetData();
+		auto index = [&](size_t i) -> size_t {
+			switch (indexSize) {
+			case 1: return indices[i];
+			case 2: { uint16_t v; CopyItems((uint8_t*)&v, indices + i * 2, 2); return v; }
+			default: { uint32_t v; CopyItems((uint8_t*)&v, indices + i * 4, 4); return v; }
+			}
+		};
+		for (size_t i = 0; i + 2 < mesh->GetIndexCount(); i += 3) {
+			size_t a = index(i), b = index(i + 1), c = index(i + 2);
+			if (a >= vertexCount || b >= vertexCount || c >= vertexCount) continue;
+			Rasterizer_->SubmitTriangle(clip[a], clip[b], clip[c]);
+		}
+	}
+
+	void Software_Renderer::Execute_(Span<const uint8_t> data, Span<const uint8_t> arena) {
+		static const UniformId transformId = UniformId::Intern("uTransform");
+
+		CommandBufferReader reader(data, arena);
+		while (true) {
+			auto type = reader.ReadType();
+			if (type == CommandType::End) break;
+
+			switch (type) {
+			case CommandType::DrawMesh:
+				DrawMesh_(reader.ReadCmdDrawMesh());
+				break;
+			case CommandType::DrawMeshInstanced:
+				// main.vert reads no per-instance attributes, so every instance
+				// covers the same pixels with the same color; one is enough.
+				DrawMesh_(reader.ReadCmdDrawMeshInstanced().DrawnMesh);
+				break;
+			case CommandType::DrawMeshes:
+				for (auto mesh : reader.ReadCmdDrawMeshes()) DrawMesh_(mesh);
+				break;
+			case CommandType::BindShader:
+				reader.ReadCmdBindShader();
+				break;
+			case CommandType::ExecuteBundle: {
+				auto *bundle = (const Software_Bundle*)reader.ReadCmdExecuteBundle();
+				Execute_(bundle->Data, bundle->Arena);
+			} break;
+			case CommandType::Uniform: {
+				auto uniform = reader.ReadCmdUniform();
+				if (uniform.Id == transformId && uniform.Type == DataType::Float32
+					&& uniform.Data.GetCount() >= sizeof(Transform_)) {
+					CopyItems((uint8_t*)Transform_, uniform.Data.GetData(), sizeof(Transform_));
+				}
+			} break;
+			case CommandType::UniformBlock: {
+				auto block = reader.ReadCmdUniformBlock();
+				auto blockData = block.InUniformArena
+					? Span<const uint8_t>(UniformArena_.GetMemory().GetData() + block.ArenaOffset, block.Size)
+					: block.Data;
+				if (block.Binding == 0 && blockData.GetCount() >= sizeof(Transform_)) {
+					CopyItems((uint8_t*)Transform_, blockData.GetData(), sizeof(Transform_));
+				}
+			} break;
+			case CommandType::Clear: {
+				auto color = reader.ReadCmdClear();
+				Rasterizer_->Clear(color.r, color.g, color.b, color.a);
+			} break;
+			case CommandType::BeginMarker:
+			case CommandType::EndMarker:
+				reader.SkipCmd(type);
+				break;
+			default:
+				fmt::print(stderr, "Unknown command {:#x} in command buffer\n", (int)type);
+				return;
+			}
+		}
+	}
+
+	void Software_Renderer::FlushCommandBuffers(Span<const Ref<CommandBuffer>> cmdBufs) {
+		for (int i = 0; i < 16; ++i) Transform_[i] = i % 5 == 0 ? 1.0f : 0.0f;
+		for (const auto &cmdBuf : cmdBufs) {
+			if (cmdBuf->GetCount() == 0) continue;
+			Execute_(cmdBuf->GetData(), cmdBuf->GetArena());
+		}
+		Rasterizer_->Resolve();
+	}
+}
@@ -0,0 +1,103 @@
+#include <av/upload.hh>
+#include <thread>
+
+namespace av::graphics {
+	void Renderer::ProcessUploads_() {
+		// Flagged before the queue is loaded. This store and load, and the
+		// destructor's detach and flag load, are all sequentially consistent,
+		// so a queue detaching either isn't seen here or sees the flag.
+		ProcessingUploads_.store(true);
+		if (auto *queue = UploadQueue_.load()) queue->Process_();
+		ProcessingUploads_.store(false, std::memory_order_release);
+	}
+
+	MeshUploadQueue::MeshUploadQueue(Renderer &renderer, size_t bytesPerFrame)
+		: Renderer_(renderer), Budget_(bytesPerFrame) {
+		Renderer_.UploadQueue_.store(this, std::memory_order_release);
+	}
+
+	MeshUploadQueue::~MeshUploadQueue() {
+		auto *self = this;
+		if (!Renderer_.UploadQueue_.compare_exchange_strong(self, nullptr)) return;
+		// A frame already working through the queue finishes first.
+		while (Renderer_.ProcessingUploads_.load()) std::this_thread::yield();
+	}
+
+	void MeshUploadQueue::Push(Span<const uint8_t> vertexData, Span<const uint8_t> indexData, const VertexSpecification &spec, Callback done) {
+		Push_(vertexData, indexData, true, spec, std::move(done));
+	}
+
+	void MeshUploadQueue::Push(Span<const uint8_t> vertexData, const VertexSpecification &spec, Callback done) {
+		Push_(vertexData, {}, false, spec, std::move(done));
+	}
+
+	void MeshUploadQueue::Push_(
+		Span<const uint8_t> vertexData, Span<const uint8_t> indexData, bool indexed,
+		const VertexSpecification &spec, Callback done
+	) {
+		// Copied outside the lock, so producers only contend on the push.
+		auto *request = new Request_ {
+			std::vector<uint8_t>(vertexData.begin(), vertexData.end()),
+			std::vector<uint8_t>(indexData.begin(), indexData.end()),
+			indexed,
+			spec.Copy(),
+			std::move(done)
+		};
+		std::lock_guard lock(Mutex_);
+		Requests_.emplace_back(request);
+		Stats_.Pending = Requests_.size();
+	}
+
+	void MeshUploadQueue::SetBudget(size_t bytesPerFrame) {
+		std::lock_guard lock(Mutex_);
+		Budget_ = bytesPerFrame;
+	}
+
+	MeshUploadQueue::Stats MeshUploadQueue::GetStats() const {
+		std::lock_guard lock(Mutex_);
+		return Stats_;
+	}
+
+	void MeshUploadQueue::Process_() {
+		size_t budget;
+		{
+			std::lock_guard lock(Mutex_);
+			budget = Budget_;
+		}
+		if (budget > ReservedBudget_) {
+			Renderer_.ReserveUploadStaging_(budget);
+			ReservedBudget_ = budget;
+		}
+
+		size_t meshes = 0, bytes = 0;
+		for (;;) {
+			std::unique_ptr<Request_> request;
+			{
+				std::lock_guard lock(Mutex_);
+				if (Requests_.empty()) break;
+				size_t size = Requests_.front()->VertexData.size() + Requests_.front()->IndexData.size();
+				if (bytes != 0 && bytes + size > budget) break;
+				request = std::move(Requests_.front());
+				Requests_.pop_front();
+				bytes += size;
+			}
+			// The callback may queue more, so the lock is not held over either.
+			auto mesh = Renderer_.UploadMesh_(
+				{ request->VertexData.data(), request->VertexData.size() },
+				{ request->IndexData.data(), request->IndexData.size() },
+				request->Indexed, request->Spec
+			);
+			meshes += 1;
+			if (request->Done) {
+				request->Done(Owned<Mesh>(mesh.Release()));
+			} else if (mesh.Get()) {
+				Renderer_.DestroyMesh(Owned<Mesh>(mesh.Release()));
+			}
+		}
+
+		std::lock_guard lock(Mutex_);
+		Stats_.Pending = Requests_.size();
+		Stats_.UploadedMeshes = meshes;
+		Stats_.UploadedBytes = bytes;
+	}
+}